@@ -0,0 +1,282 @@
+#include "commonStructs.h"
+#include "cputracer.hpp"
+#include "device.hpp"
+#include "geometry.hpp"
+#include "job.hpp"
+#include "orayobject.hpp"
+#include "raytracing.hpp"
+#include "state.hpp"
+#include "threadpool.hpp"
+#include "tracingengine.hpp"
+#include "viewfactors.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// whole model traces without a window, for job schedulers. Run from bin/ like
+// the app, the vulkan engine loads its shaders from spv/.
+// usage: oray-batch mesh.obj rays random|sobol output.csv [vulkan|cpu]
+//        oray-batch job.json
+// rays are traced per triangle. Every line of an output holds the view
+// factors of one source triangle, followed by their 95% confidence half
+// width. A job file (see job.hpp) runs several cases against one scene: the
+// meshes are loaded and the acceleration structures built once, each case
+// only updates the transforms, emissivities and sampling that differ from the
+// case before. The cases trace one after the other, only the output of a case
+// is written while the next one traces.
+
+namespace {
+using Clock = std::chrono::high_resolution_clock;
+
+constexpr char const *USAGE =
+    "usage: oray-batch mesh.obj rays random|sobol output.csv [vulkan|cpu]\n"
+    "       oray-batch job.json";
+
+// a job file, or a job of a single case from the command line
+oray::Job parseArguments(int argc, char *argv[]) {
+  if (argc == 2) {
+    return oray::Job::load(argv[1]);
+  }
+  if (argc < 5 || argc > 6) {
+    throw std::runtime_error(USAGE);
+  }
+  oray::Job job{};
+  oray::Job::Object object{};
+  object.mesh = argv[1];
+
+  oray::State defaults{};
+  oray::Job::Case single{};
+  single.name = object.mesh;
+  single.sampling = oray::TracingEngine::Sampling::fromState(defaults);
+  char *end = nullptr;
+  unsigned long nRays = std::strtoul(argv[2], &end, 10);
+  if (*end != '\0' || nRays == 0 || nRays > UINT32_MAX) {
+    throw std::runtime_error("rays must be a positive number!");
+  }
+  single.sampling.nRays = static_cast<uint32_t>(nRays);
+
+  std::string sampler = argv[3];
+  if (sampler == "random") {
+    single.sampling.sampler = oray::SAMPLER_RANDOM;
+  } else if (sampler == "sobol") {
+    single.sampling.sampler = oray::SAMPLER_SOBOL;
+  } else {
+    throw std::runtime_error("unknown sampler " + sampler + "!");
+  }
+
+  single.output = argv[4];
+  if (argc == 6) {
+    std::string engine = argv[5];
+    if (engine == "cpu") {
+      job.engine = oray::ENGINE_CPU;
+    } else if (engine != "vulkan") {
+      throw std::runtime_error("unknown engine " + engine + "!");
+    }
+  }
+  single.transforms.push_back(object.transform);
+  single.emissivities.push_back(object.emissivity);
+  job.objects.push_back(std::move(object));
+  job.cases.push_back(std::move(single));
+  return job;
+}
+
+double millisecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+void writeViewFactors(std::string const &path,
+                      std::vector<float> const &viewFactors,
+                      std::vector<float> const &rowErrors,
+                      uint32_t nTriangles) {
+  std::ofstream file{path};
+  if (!file) {
+    throw std::runtime_error("failed to open " + path + "!");
+  }
+  for (uint32_t src = 0; src < nTriangles; ++src) {
+    float const *row =
+        viewFactors.data() + static_cast<size_t>(src) * nTriangles;
+    for (uint32_t target = 0; target < nTriangles; ++target) {
+      file << row[target] << ',';
+    }
+    file << rowErrors[src] << '\n';
+  }
+  if (!file) {
+    throw std::runtime_error("failed to write " + path + "!");
+  }
+}
+
+bool sameTransform(oray::TransformComponent const &a,
+                   oray::TransformComponent const &b) {
+  return a.translation == b.translation && a.rotation == b.rotation &&
+         a.scale == b.scale;
+}
+
+// view factors and output of a finished case, runs while the engine traces
+// the next one
+void writeCase(oray::Job::Case const &c,
+               oray::TracingEngine::Tallies const &tallies,
+               uint32_t nTriangles) {
+  if (c.output.empty()) {
+    return;
+  }
+  std::vector<float> viewFactors;
+  std::vector<float> rowErrors;
+  oray::computeViewFactors(tallies.counts, tallies.rowRays, viewFactors,
+                           rowErrors);
+  writeViewFactors(c.output, viewFactors, rowErrors, nTriangles);
+}
+
+void runJob(oray::Job const &job) {
+  auto state = std::make_shared<oray::State>();
+
+  // objects that share a mesh share its Geometry and bottom level
+  // acceleration structure
+  auto start = Clock::now();
+  std::map<std::string, oray::Geometry::Builder> builders;
+  for (auto const &object : job.objects) {
+    if (builders.count(object.mesh) == 0) {
+      builders[object.mesh].loadModel(object.mesh);
+    }
+  }
+  double loadTime = millisecondsSince(start);
+
+  // declared in the order of their lifetimes, the engine goes first
+  std::unique_ptr<oray::Device> device;
+  std::vector<oray::OrayObject> objects;
+  std::unique_ptr<oray::TracingEngine> engine;
+  start = Clock::now();
+  std::map<std::string, std::shared_ptr<oray::Geometry>> geometries;
+  if (job.engine == oray::ENGINE_VULKAN) {
+    device = std::make_unique<oray::Device>();
+    for (auto const &[mesh, builder] : builders) {
+      geometries[mesh] = std::make_shared<oray::Geometry>(*device, builder);
+    }
+  }
+  std::vector<oray::CpuTracer::Instance> instances;
+  for (auto const &jobObject : job.objects) {
+    auto object = oray::OrayObject::createOrayObject();
+    if (device) {
+      object.geom = geometries.at(jobObject.mesh);
+    }
+    object.transform = jobObject.transform;
+    object.emissivity = jobObject.emissivity;
+    instances.push_back({&builders.at(jobObject.mesh),
+                         object.transform.mat4(), object.emissivity});
+    objects.push_back(std::move(object));
+  }
+  if (device) {
+    engine = std::make_unique<oray::Raytracer>(*device, objects, state);
+  } else {
+    engine = std::make_unique<oray::CpuTracer>(instances, state);
+  }
+  double setupTime = millisecondsSince(start);
+
+  uint32_t nTriangles = engine->triangleCount();
+  std::vector<uint32_t> triangles(nTriangles);
+  for (uint32_t i = 0; i < nTriangles; ++i) {
+    triangles[i] = i;
+  }
+  std::cout << job.cases.size() << " case(s), " << nTriangles
+            << " triangles on the " << engine->name() << " engine" << std::endl
+            << "  mesh load:       " << loadTime << " ms" << std::endl
+            << "  engine setup:    " << setupTime << " ms" << std::endl
+            << "  as build:        " << engine->buildTime() << " ms"
+            << std::endl;
+
+  // the output of a case is written on the pool while the next case traces.
+  // The device does not overlap cases: launch and readTallies block, and the
+  // update of the next case starts after the readback. At most one case waits
+  // for its output, which bounds the tallies in memory to two n x n matrices.
+  std::unique_ptr<oray::ThreadPool::TaskGroup> output;
+  auto jobStart = Clock::now();
+  double totalRays = 0.;
+  try {
+    for (auto const &c : job.cases) {
+      start = Clock::now();
+      bool moved = false;
+      bool materialsChanged = false;
+      for (size_t i = 0; i < objects.size(); ++i) {
+        if (!sameTransform(objects[i].transform, c.transforms[i])) {
+          objects[i].transform = c.transforms[i];
+          moved = true;
+        }
+        if (objects[i].emissivity != c.emissivities[i]) {
+          objects[i].emissivity = c.emissivities[i];
+          materialsChanged = true;
+        }
+      }
+      if (moved) {
+        engine->updateInstances(objects);
+      }
+      if (materialsChanged) {
+        engine->updateMaterials(objects);
+      }
+      engine->resetTallies(c.sampling);
+      double updateTime = millisecondsSince(start);
+
+      start = Clock::now();
+      engine->launch(triangles);
+      double traceTime = millisecondsSince(start);
+
+      start = Clock::now();
+      auto tallies = std::make_shared<oray::TracingEngine::Tallies>(
+          engine->readTallies());
+      double readbackTime = millisecondsSince(start);
+
+      if (output) {
+        output->wait();
+      }
+      output = std::make_unique<oray::ThreadPool::TaskGroup>(
+          oray::ThreadPool::shared());
+      output->run([&c, tallies, nTriangles]() {
+        writeCase(c, *tallies, nTriangles);
+      });
+
+      double nRays = static_cast<double>(c.sampling.nRays) * nTriangles;
+      totalRays += nRays;
+      std::cout << c.name << ":" << std::endl
+                << "  update:          " << updateTime << " ms"
+                << (moved ? ", instances" : "")
+                << (materialsChanged ? ", materials" : "") << std::endl
+                << "  trace:           " << traceTime << " ms, "
+                << nRays / (traceTime / 1000.) << " rays/s" << std::endl
+                << "  readback:        " << readbackTime << " ms" << std::endl;
+    }
+  } catch (...) {
+    // destroying the group would cancel the output of the last finished case
+    if (output) {
+      try {
+        output->wait();
+      } catch (...) {
+        // the error of the failed case is reported instead
+      }
+    }
+    throw;
+  }
+  if (output) {
+    output->wait();
+  }
+  double jobTime = millisecondsSince(jobStart);
+  std::cout << "all cases:         " << jobTime << " ms, "
+            << totalRays / (jobTime / 1000.) << " rays/s" << std::endl;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    runJob(parseArguments(argc, argv));
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+#include "bvh.hpp"
+#include "commonStructs.h"
+#include "cputracer.hpp"
+#include "geometry.hpp"
+#include "state.hpp"
+#include "widebvh.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// throughput of the CPU tracer, run from bin/ like the app.
+// usage: oray-bench [model.obj ...]
+
+namespace {
+// rays per model and traversal, spread evenly over the triangles
+constexpr uint64_t RAYS_PER_RUN = 4000000;
+// the builds of a model are timed this often, the fastest one counts
+constexpr int BUILD_REPEATS = 5;
+
+// build time of the Bvh for 1, 2, 4, ... threads up to every core
+void benchBuild(std::string const &path,
+                oray::Geometry::Builder const &builder) {
+  std::vector<glm::vec3> corners;
+  for (uint32_t idx : builder.indices) {
+    corners.push_back(builder.vertices[idx].position);
+  }
+  unsigned nCores = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned> threadCounts;
+  for (unsigned n = 1; n < nCores; n *= 2) {
+    threadCounts.push_back(n);
+  }
+  threadCounts.push_back(nCores);
+
+  for (bool spatialSplits : {false, true}) {
+    for (unsigned nThreads : threadCounts) {
+      oray::BvhOptions options{nThreads, spatialSplits};
+      double best = std::numeric_limits<double>::max();
+      size_t nReferences = 0;
+      for (int i = 0; i < BUILD_REPEATS; ++i) {
+        auto start = std::chrono::high_resolution_clock::now();
+        oray::Bvh bvh{corners, options};
+        best = std::min(
+            best, std::chrono::duration<double, std::milli>(
+                      std::chrono::high_resolution_clock::now() - start)
+                      .count());
+        nReferences = bvh.referenceCount();
+      }
+      std::cout << path << " build"
+                << (spatialSplits ? " with spatial splits" : "") << ": "
+                << best << " ms on " << nThreads << " threads, "
+                << nReferences << " references" << std::endl;
+    }
+  }
+}
+
+// rays per second of every traversal
+void benchTrace(std::string const &path,
+                oray::Geometry::Builder const &builder, bool spatialSplits) {
+  auto state = std::make_shared<oray::State>();
+  state->cpuSpatialSplits = spatialSplits;
+  oray::CpuTracer tracer({{&builder}}, state);
+  uint32_t nTriangles = tracer.triangleCount();
+
+  std::vector<oray::RowEntry> rows(nTriangles);
+  for (uint32_t i = 0; i < nTriangles; ++i) {
+    rows[i] = {i, 0};
+  }
+  oray::CpuTracer::Settings settings{};
+  settings.nRays = static_cast<uint32_t>(
+      std::max<uint64_t>(1, RAYS_PER_RUN / nTriangles));
+  double nRays = static_cast<double>(settings.nRays) * nTriangles;
+  unsigned nCores = tracer.threadCount();
+
+  std::cout << path << " nodes: binary "
+            << tracer.getBvh().nodeMemorySize() / 1024 << " KiB, "
+            << oray::WideBvh::WIDTH << " wide "
+            << tracer.getWideBvh().nodeMemorySize() / 1024 << " KiB"
+            << std::endl;
+
+  char const *names[] = {"single", "packet", "stream", "wide"};
+  for (auto traversal : {oray::TRAVERSAL_SINGLE, oray::TRAVERSAL_PACKET,
+                         oray::TRAVERSAL_STREAM, oray::TRAVERSAL_WIDE}) {
+    settings.traversal = traversal;
+    std::vector<uint64_t> counts;
+    auto start = std::chrono::high_resolution_clock::now();
+    tracer.trace(settings, rows, counts);
+    double seconds =
+        std::chrono::duration<double, std::chrono::seconds::period>(
+            std::chrono::high_resolution_clock::now() - start)
+            .count();
+    std::cout << path << " " << names[traversal]
+              << (spatialSplits ? " with spatial splits" : "") << ": "
+              << nRays / seconds / nCores / 1e6 << " Mrays/s per core on "
+              << nCores << " cores" << std::endl;
+  }
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> models{"models/two_plates.obj",
+                                  "models/flat_vase.obj",
+                                  "models/smooth_vase.obj"};
+  if (argc > 1) {
+    models.assign(argv + 1, argv + argc);
+  }
+  try {
+    for (auto const &model : models) {
+      oray::Geometry::Builder builder{};
+      builder.loadModel(model);
+      benchBuild(model, builder);
+      benchTrace(model, builder, false);
+      benchTrace(model, builder, true);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
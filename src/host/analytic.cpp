@@ -0,0 +1,44 @@
+#include "analytic.hpp"
+
+#include <glm/gtc/constants.hpp>
+
+#include <cmath>
+
+namespace oray {
+namespace analytic {
+
+// closed form for parallel rectangles, see e.g. Howell's catalog of
+// radiation configuration factors, C-11
+static double parallelRectanglesKernel(double x, double y, double z) {
+  double xz = std::sqrt(x * x + z * z);
+  double yz = std::sqrt(y * y + z * z);
+  double g = y * xz * std::atan(y / xz) + x * yz * std::atan(x / yz) -
+             0.5 * z * z * std::log(x * x + y * y + z * z);
+  return g / (2. * glm::pi<double>());
+}
+
+float parallelRectangles(glm::vec2 min1, glm::vec2 max1, glm::vec2 min2,
+                         glm::vec2 max2, float distance) {
+  const double x[2] = {min1.x, max1.x};
+  const double y[2] = {min1.y, max1.y};
+  const double xi[2] = {min2.x, max2.x};
+  const double eta[2] = {min2.y, max2.y};
+
+  double sum = 0.;
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      for (int k = 0; k < 2; ++k) {
+        for (int l = 0; l < 2; ++l) {
+          double sign = ((i + j + k + l) % 2 == 0) ? 1. : -1.;
+          sum += sign * parallelRectanglesKernel(x[i] - xi[k], y[j] - eta[l],
+                                                 distance);
+        }
+      }
+    }
+  }
+  double area = (x[1] - x[0]) * (y[1] - y[0]);
+  return static_cast<float>(sum / area);
+}
+
+} // namespace analytic
+} // namespace oray
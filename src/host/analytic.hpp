@@ -0,0 +1,15 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace oray {
+namespace analytic {
+// view factor from rectangle 1 to a parallel rectangle 2 at distance
+// `distance`, both rectangles given by their corners in a common in-plane
+// coordinate system
+float parallelRectangles(glm::vec2 min1, glm::vec2 max1, glm::vec2 min2,
+                         glm::vec2 max2, float distance);
+} // namespace analytic
+} // namespace oray
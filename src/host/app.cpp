@@ -2,6 +2,7 @@
 
 #include "buffer.hpp"
 #include "camera.hpp"
+#include "cputracer.hpp"
 #include "descriptors.hpp"
 #include "device.hpp"
 #include "frameinfo.hpp"
@@ -14,6 +15,7 @@
 #include "raytracing.hpp"
 #include "rendersystem.hpp"
 #include "state.hpp"
+#include "tracingengine.hpp"
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
@@ -24,6 +26,7 @@
 
 #include <array>
 #include <chrono>
+#include <iostream>
 #include <memory>
 #include <stdexcept>
 
@@ -43,7 +46,7 @@ Application::Application() {
                                 SwapChain::MAX_FRAMES_IN_FLIGHT)
                    .build();
   loadOrayObjects();
-  state->setTriangleNames(orayObjects->data());
+  state->setTriangleNames(*orayObjects);
   initRaytracer();
 }
 
@@ -126,11 +129,65 @@ void Application::run() {
 
 
 
-    if (auto commandBuffer = renderer.beginFrame()) {
+    if (state->engineChanged) {
+      selectEngine();
+      state->engineChanged = false;
+    }
+    if (state->materialsChanged) {
+      for (auto &obj : *orayObjects) {
+        obj.emissivity = state->emissivity;
+      }
+      raytracer->updateMaterials(*orayObjects);
+      if (cpuTracer) {
+        cpuTracer->updateMaterials(*orayObjects);
+      }
+      state->materialsChanged = false;
+    }
+    bool triangleRequested = state->doTrace && state->nRays != 0;
+    if (state->doTraceModel) {
+      // the frames keep coming while the GPU traces
+      if (engine == raytracer.get()) {
+        raytracer->beginModelTrace();
+        modelTraceInFlight = true;
+      } else {
+        auto start = std::chrono::high_resolution_clock::now();
+        engine->traceModel();
+        double seconds =
+            std::chrono::duration<double, std::chrono::seconds::period>(
+                std::chrono::high_resolution_clock::now() - start)
+                .count();
+        double nRays =
+            static_cast<double>(state->nRays) * engine->triangleCount();
+        std::cout << engine->name() << " trace of " << nRays << " rays took "
+                  << seconds << " s, " << nRays / seconds << " rays/s"
+                  << std::endl;
+      }
+      state->doTraceModel = false;
+    }
+    if (modelTraceInFlight) {
+      raytracer->pollLaunch();
+      if (!raytracer->isLaunching()) {
+        modelTraceInFlight = false;
+      }
+    } else if (state->progressive && engine == raytracer.get()) {
+      // background launches are asynchronous on the GPU only. A pending
+      // triangle trace would queue behind the next one, so none is started.
+      if (triangleRequested) {
+        raytracer->pollLaunch();
+      } else {
+        raytracer->refine();
+      }
+    }
 
-       if (state->doTrace && state->nRays != 0) {
-      raytracer->traceTriangle(commandBuffer);
-      state->doTrace = false;
+    if (auto commandBuffer = renderer.beginFrame()) {
+      // the triangle trace shares the compute queue with the launches. It
+      // writes a set of ray buffers the frames in flight do not draw.
+      if (triangleRequested && !raytracer->isLaunching() &&
+          !raytracer->triangleSignalPending) {
+        renderer.waitForSemaphore(raytracer->traceTriangle(),
+                                  VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                                  &raytracer->triangleSignalPending);
+        state->doTrace = false;
       }
 
 
@@ -209,8 +266,11 @@ std::unique_ptr<Geometry> createCubeModel(Device &device, glm::vec3 offset) {
 }
 
 void Application::loadOrayObjects() {
+  Geometry::Builder builder{};
+  builder.loadModel(MODEL_PATH);
   std::shared_ptr<Geometry> geometry =
-      Geometry::createModelFromFile(device, "models/two_plates.obj");
+      std::make_shared<Geometry>(device, builder);
+  geometrySources[geometry.get()] = std::move(builder);
 
   auto orayObj = OrayObject::createOrayObject();
   orayObj.geom = geometry;
@@ -220,11 +280,25 @@ void Application::loadOrayObjects() {
 }
 
 void Application::initRaytracer() {
+  // the first frame traces the triangle, state->doTrace starts set
   raytracer = std::make_unique<Raytracer>(device, *orayObjects, state);
-  VkCommandBuffer buf = device.beginSingleTimeCommands();
-  raytracer->traceTriangle(buf);
-  device.endSingleTimeCommands(buf);
-  vkDeviceWaitIdle(device.device());
+  selectEngine();
+}
+
+void Application::selectEngine() {
+  if (state->engine == ENGINE_CPU) {
+    // built again, the spatial split setting may have changed
+    cpuTracer.reset();
+    cpuTracer =
+        std::make_unique<CpuTracer>(*orayObjects, geometrySources, state);
+    engine = cpuTracer.get();
+  } else {
+    cpuTracer.reset();
+    engine = raytracer.get();
+  }
+  std::cout << "tracing models with the " << engine->name()
+            << " engine, acceleration structures built in "
+            << engine->buildTime() << " ms" << std::endl;
 }
 
 } // namespace oray
\ No newline at end of file
@@ -1,11 +1,13 @@
 #pragma once
 
+#include "cputracer.hpp"
 #include "descriptors.hpp"
 #include "geometry.hpp"
 #include "orayobject.hpp"
 #include "renderer.hpp"
 #include "window.hpp"
 #include "raytracing.hpp"
+#include "tracingengine.hpp"
 
 #include <chrono>
 #include <cstdint>
@@ -18,6 +20,7 @@ public:
   static constexpr uint32_t WIDTH = 800;
   static constexpr uint32_t HEIGHT = 600;
   static constexpr float MAX_FRAME_TIME = 0.2;
+  static constexpr const char *MODEL_PATH = "models/two_plates.obj";
 
   void run();
 
@@ -30,6 +33,8 @@ public:
 private:
   void loadOrayObjects();
   void initRaytracer();
+  // points engine to the tracer of state->engine
+  void selectEngine();
   std::shared_ptr<State> state = std::make_shared<State>();
   Window window{WIDTH, HEIGHT, "Hello VLKN!"};
   Device device{window};
@@ -39,7 +44,16 @@ private:
   std::shared_ptr<std::vector<OrayObject>> orayObjects =
       std::make_shared<std::vector<OrayObject>>();
 
+  // also traces and draws the rays of the selected triangle with any engine
   std::unique_ptr<Raytracer> raytracer;
+  // the vertices and indices of every Geometry stay on the host for the
+  // CpuTracer, which is only created when the cpu engine is selected
+  TracingEngine::GeometrySources geometrySources;
+  std::unique_ptr<CpuTracer> cpuTracer;
+  // traces the model, either the raytracer or the cpuTracer
+  TracingEngine *engine = nullptr;
+  // a model trace of the raytracer runs on the compute queue
+  bool modelTraceInFlight = false;
 };
 
 } // namespace oray
\ No newline at end of file
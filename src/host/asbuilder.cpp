@@ -0,0 +1,74 @@
+#include "asbuilder.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+namespace oray {
+
+namespace {
+VkDeviceSize alignUp(VkDeviceSize val, VkDeviceSize align) {
+  return (val + align - 1) / align * align;
+}
+} // namespace
+
+AsBuilder::AsBuilder(Device &device, VulkanFunctions &f)
+    : device{device}, f{f} {
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR asProps{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
+  VkPhysicalDeviceProperties2 prop2{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+  prop2.pNext = &asProps;
+  vkGetPhysicalDeviceProperties2(device.getPhysicalDevice(), &prop2);
+  scratchAlignment = asProps.minAccelerationStructureScratchOffsetAlignment;
+}
+
+void AsBuilder::add(VkAccelerationStructureBuildGeometryInfoKHR buildInfo,
+                    VkAccelerationStructureGeometryKHR const &geometry,
+                    uint32_t primitiveCount, VkDeviceSize buildScratchSize) {
+  geometries.push_back(geometry);
+  buildInfo.geometryCount = 1;
+  buildInfo.pGeometries = &geometries.back();
+  buildInfos.push_back(buildInfo);
+
+  VkAccelerationStructureBuildRangeInfoKHR rangeInfo{};
+  rangeInfo.primitiveCount = primitiveCount;
+  rangeInfos.push_back(rangeInfo);
+
+  scratchOffsets.push_back(scratchSize);
+  scratchSize += alignUp(buildScratchSize, scratchAlignment);
+}
+
+void AsBuilder::record(VkCommandBuffer cmdBuf) {
+  if (buildInfos.empty()) {
+    return;
+  }
+
+  // the allocation itself is not guaranteed to start at the alignment
+  scratchBuffer = std::make_unique<Buffer>(
+      device, scratchSize + scratchAlignment, 1,
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      0);
+  VkDeviceAddress scratchAddress =
+      alignUp(scratchBuffer->getAddress(), scratchAlignment);
+
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR const *> pRangeInfos;
+  for (size_t i = 0; i < buildInfos.size(); ++i) {
+    buildInfos[i].scratchData.deviceAddress =
+        scratchAddress + scratchOffsets[i];
+    pRangeInfos.push_back(&rangeInfos[i]);
+  }
+  f.vkCmdBuildAccelerationStructuresKHR(
+      cmdBuf, static_cast<uint32_t>(buildInfos.size()), buildInfos.data(),
+      pRangeInfos.data());
+
+  VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+  vkCmdPipelineBarrier(cmdBuf,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR |
+                           VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+} // namespace oray
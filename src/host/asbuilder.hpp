@@ -0,0 +1,50 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "device.hpp"
+#include "functions.hpp"
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace oray {
+
+// collects acceleration structure builds and records them as a single
+// vkCmdBuildAccelerationStructuresKHR call. The builds share one scratch
+// buffer, suballocated at the scratch offset alignment of the device.
+class AsBuilder {
+public:
+  AsBuilder(Device &device, VulkanFunctions &f);
+
+  AsBuilder(const AsBuilder &) = delete;
+  AsBuilder &operator=(const AsBuilder &) = delete;
+
+  // buildInfo describes a build of the single geometry `geometry`, the
+  // builder sets its geometry pointer and scratch address
+  void add(VkAccelerationStructureBuildGeometryInfoKHR buildInfo,
+           VkAccelerationStructureGeometryKHR const &geometry,
+           uint32_t primitiveCount, VkDeviceSize buildScratchSize);
+  bool empty() const { return buildInfos.empty(); }
+
+  // records all builds, followed by one barrier that makes the results
+  // visible to later builds, copies, queries and traces. The scratch buffer
+  // must stay alive until the command buffer has executed, it belongs to the
+  // builder.
+  void record(VkCommandBuffer cmdBuf);
+
+private:
+  Device &device;
+  VulkanFunctions &f;
+  VkDeviceSize scratchAlignment = 1;
+
+  // deque, the build infos point into it
+  std::deque<VkAccelerationStructureGeometryKHR> geometries;
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos;
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR> rangeInfos;
+  std::vector<VkDeviceSize> scratchOffsets;
+  VkDeviceSize scratchSize = 0;
+  std::unique_ptr<Buffer> scratchBuffer;
+};
+
+} // namespace oray
@@ -0,0 +1,794 @@
+#include "bvh.hpp"
+#include "bvhkernels.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+namespace oray {
+
+using kernels::intersectBlock;
+
+namespace {
+constexpr uint32_t SAH_BINS = 16;
+// below this depth the builder falls back to median splits, which bounds the
+// depth of the tree and with it the traversal stack
+constexpr uint32_t MAX_SAH_DEPTH = 32;
+constexpr uint32_t STACK_SIZE = 64;
+
+// nodes with fewer references are binned and partitioned by one thread
+constexpr size_t PARALLEL_REFERENCES = 1 << 15;
+// children with fewer references are built by the task of their parent
+constexpr size_t TASK_REFERENCES = 1 << 11;
+// spatial splits are searched where the children of the object split overlap
+// by more than this fraction of the scene, alpha in Stich et al.
+constexpr float SPATIAL_SPLIT_OVERLAP = 1e-5f;
+// references that spatial splits may add, relative to the triangles
+constexpr float SPATIAL_SPLIT_BUDGET = 0.5f;
+// relative growth of clipped boxes, covers the rounding of the clip points
+constexpr float CLIP_PADDING = 4 * std::numeric_limits<float>::epsilon();
+
+float halfArea(glm::vec3 min, glm::vec3 max) {
+  glm::vec3 d = max - min;
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// axis aligned box of the builder, empty until it grows
+struct Aabb {
+  glm::vec3 min{std::numeric_limits<float>::max()};
+  glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+  void grow(glm::vec3 p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  void grow(Aabb const &box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+  Aabb intersection(Aabb const &box) const {
+    return {glm::max(min, box.min), glm::min(max, box.max)};
+  }
+  bool empty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+  glm::vec3 center() const { return 0.5f * (min + max); }
+  float halfArea() const { return empty() ? 0.f : oray::halfArea(min, max); }
+};
+
+// entry distance of the ray into the box, infinity if it misses the box
+// within [tMin, tMax]
+float boxEntry(Bvh::Node const &node, glm::vec3 ori, glm::vec3 invDir,
+               float tMin, float tMax) {
+  glm::vec3 t0 = (node.min - ori) * invDir;
+  glm::vec3 t1 = (node.max - ori) * invDir;
+  glm::vec3 tNear = glm::min(t0, t1);
+  glm::vec3 tFar = glm::max(t0, t1);
+  float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tMin));
+  float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+  return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+}
+
+// rays of a packet as structure of arrays. Unused lanes repeat the last ray,
+// they are masked out of the traversal.
+struct PacketRays {
+  alignas(32) float ori[3][Bvh::PACKET_SIZE];
+  alignas(32) float invDir[3][Bvh::PACKET_SIZE];
+  alignas(32) float tMin[Bvh::PACKET_SIZE];
+  alignas(32) float tMax[Bvh::PACKET_SIZE];
+};
+
+// slab test of all rays of the packet against the box. Returns the lanes of
+// `active` that enter it, entry is the smallest entry distance among them.
+#if defined(__AVX2__)
+uint32_t packetBoxEntry(Bvh::Node const &node, PacketRays const &rays,
+                        uint32_t active, float &entry) {
+  __m256 tNear = _mm256_load_ps(rays.tMin);
+  __m256 tFar = _mm256_load_ps(rays.tMax);
+  for (int k = 0; k < 3; ++k) {
+    __m256 ori = _mm256_load_ps(rays.ori[k]);
+    __m256 invDir = _mm256_load_ps(rays.invDir[k]);
+    __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.min[k]), ori),
+                              invDir);
+    __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.max[k]), ori),
+                              invDir);
+    tNear = _mm256_max_ps(tNear, _mm256_min_ps(t0, t1));
+    tFar = _mm256_min_ps(tFar, _mm256_max_ps(t0, t1));
+  }
+  __m256 enters = _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ);
+  uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(enters)) & active;
+  alignas(32) float entries[Bvh::PACKET_SIZE];
+  _mm256_store_ps(entries, tNear);
+  entry = std::numeric_limits<float>::infinity();
+  for (uint32_t i = 0; i < Bvh::PACKET_SIZE; ++i) {
+    if ((mask & (1u << i)) != 0) {
+      entry = std::min(entry, entries[i]);
+    }
+  }
+  return mask;
+}
+#else
+// fixed trip count loops, the compiler vectorizes them for the target
+uint32_t packetBoxEntry(Bvh::Node const &node, PacketRays const &rays,
+                        uint32_t active, float &entry) {
+  float tNear[Bvh::PACKET_SIZE];
+  float tFar[Bvh::PACKET_SIZE];
+  for (uint32_t i = 0; i < Bvh::PACKET_SIZE; ++i) {
+    tNear[i] = rays.tMin[i];
+    tFar[i] = rays.tMax[i];
+  }
+  for (int k = 0; k < 3; ++k) {
+    for (uint32_t i = 0; i < Bvh::PACKET_SIZE; ++i) {
+      float t0 = (node.min[k] - rays.ori[k][i]) * rays.invDir[k][i];
+      float t1 = (node.max[k] - rays.ori[k][i]) * rays.invDir[k][i];
+      tNear[i] = std::max(tNear[i], std::min(t0, t1));
+      tFar[i] = std::min(tFar[i], std::max(t0, t1));
+    }
+  }
+  uint32_t mask = 0;
+  entry = std::numeric_limits<float>::infinity();
+  for (uint32_t i = 0; i < Bvh::PACKET_SIZE; ++i) {
+    if ((active & (1u << i)) != 0 && tNear[i] <= tFar[i]) {
+      mask |= 1u << i;
+      entry = std::min(entry, tNear[i]);
+    }
+  }
+  return mask;
+}
+#endif
+
+} // namespace
+
+// a reference to a triangle, or with spatial splits to the part of it inside
+// box
+struct Bvh::Reference {
+  Aabb box;
+  uint32_t triangle;
+};
+
+// tree of the builder, flattened into nodes afterwards
+struct Bvh::BuildNode {
+  Aabb box;
+  std::unique_ptr<BuildNode> children[2];
+  std::vector<uint32_t> triangles;
+};
+
+// binned SAH builder. Large nodes are binned and partitioned in chunks, the
+// children of large nodes are built as subtrees of their own. Both are tasks
+// of the pool, without a pool the build runs on the calling thread.
+class Bvh::Builder {
+public:
+  Builder(std::vector<glm::vec3> const &corners, BvhOptions const &options,
+          ThreadPool *pool)
+      : corners{corners}, spatialSplits{options.spatialSplits}, pool{pool} {
+    // the workers and the waiting thread
+    nThreads = pool ? pool->threadCount() + 1 : 1;
+    spatialBudget = static_cast<int64_t>(
+        SPATIAL_SPLIT_BUDGET * static_cast<float>(corners.size() / 3));
+  }
+
+  std::unique_ptr<BuildNode> build(std::vector<Reference> refs,
+                                   uint32_t depth);
+  unsigned chunks(size_t nRefs) const {
+    return nRefs < PARALLEL_REFERENCES ? 1 : nThreads;
+  }
+  // runs f(begin, end, chunk) for nChunks consecutive chunks of [0, n), every
+  // chunk but the first as a task of the pool
+  template <typename F>
+  void forChunks(size_t n, unsigned nChunks, F const &f) const {
+    if (nChunks == 1) {
+      f(0, n, 0u);
+      return;
+    }
+    ThreadPool::TaskGroup group{*pool};
+    for (unsigned c = 1; c < nChunks; ++c) {
+      group.run([&f, n, nChunks, c]() {
+        f(n * c / nChunks, n * (c + 1) / nChunks, c);
+      });
+    }
+    f(0, n / nChunks, 0u);
+    group.wait();
+  }
+
+private:
+  struct Split {
+    float cost = std::numeric_limits<float>::max();
+    int axis = -1;
+    // the plane lies between bin and bin + 1
+    uint32_t bin = 0;
+    bool spatial = false;
+    Aabb left;
+    Aabb right;
+    uint32_t nLeft = 0;
+    uint32_t nRight = 0;
+  };
+  // per bin: the bounds of the references in it, how many references start
+  // and end in it. Without spatial splits both counts are the same.
+  struct Bin {
+    Aabb box;
+    uint32_t enter = 0;
+    uint32_t exit = 0;
+  };
+  using AxisBins = std::array<std::array<Bin, SAH_BINS>, 3>;
+
+  static uint32_t binIndex(float value, float min, float scale) {
+    return std::min(SAH_BINS - 1, static_cast<uint32_t>(std::max(
+                                      0.f, (value - min) * scale)));
+  }
+  static void sweep(std::array<Bin, SAH_BINS> const &bins, int axis,
+                    bool spatial, Split &best);
+  static AxisBins mergeBins(std::vector<AxisBins> const &chunkBins);
+
+  Split objectSplit(std::vector<Reference> const &refs, Aabb centroids) const;
+  Split spatialSplit(std::vector<Reference> const &refs, Aabb bounds) const;
+  void partition(std::vector<Reference> const &refs, Split const &split,
+                 Aabb const &bounds, Aabb const &centroids,
+                 std::vector<Reference> &left,
+                 std::vector<Reference> &right) const;
+  Aabb clip(Reference const &ref, int axis, float lo, float hi) const;
+
+  std::vector<glm::vec3> const &corners;
+  bool spatialSplits;
+  ThreadPool *pool;
+  unsigned nThreads = 1;
+  float rootArea = 0.f;
+  // references that spatial splits may still add
+  std::atomic<int64_t> spatialBudget{0};
+};
+
+std::unique_ptr<Bvh::BuildNode>
+Bvh::Builder::build(std::vector<Reference> refs, uint32_t depth) {
+  auto node = std::make_unique<BuildNode>();
+  unsigned nChunks = chunks(refs.size());
+  std::vector<Aabb> chunkBounds(nChunks);
+  std::vector<Aabb> chunkCentroids(nChunks);
+  forChunks(refs.size(), nChunks, [&](size_t begin, size_t end, unsigned c) {
+    for (size_t i = begin; i < end; ++i) {
+      chunkBounds[c].grow(refs[i].box);
+      chunkCentroids[c].grow(refs[i].box.center());
+    }
+  });
+  Aabb centroids;
+  for (unsigned c = 0; c < nChunks; ++c) {
+    node->box.grow(chunkBounds[c]);
+    centroids.grow(chunkCentroids[c]);
+  }
+  if (depth == 0) {
+    rootArea = node->box.halfArea();
+  }
+
+  if (refs.size() <= LEAF_SIZE) {
+    for (auto const &ref : refs) {
+      node->triangles.push_back(ref.triangle);
+    }
+    return node;
+  }
+
+  Split split;
+  if (depth < MAX_SAH_DEPTH) {
+    split = objectSplit(refs, centroids);
+    // only where the children of the object split overlap much, like around
+    // long thin triangles, can splitting triangles pay off
+    Aabb overlap = split.left.intersection(split.right);
+    if (spatialSplits && split.axis >= 0 && !overlap.empty() &&
+        overlap.halfArea() > SPATIAL_SPLIT_OVERLAP * rootArea) {
+      Split spatial = spatialSplit(refs, node->box);
+      int64_t duplicates = static_cast<int64_t>(spatial.nLeft) +
+                           spatial.nRight - static_cast<int64_t>(refs.size());
+      if (spatial.cost < split.cost) {
+        if (spatialBudget.fetch_sub(duplicates) >= duplicates) {
+          split = spatial;
+        } else {
+          spatialBudget.fetch_add(duplicates);
+        }
+      }
+    }
+  }
+
+  std::vector<Reference> left;
+  std::vector<Reference> right;
+  if (split.axis >= 0) {
+    partition(refs, split, node->box, centroids, left, right);
+  }
+  // no usable SAH split, e.g. all centroids in one point
+  if (left.empty() || right.empty()) {
+    left.clear();
+    right.clear();
+    size_t mid = refs.size() / 2;
+    glm::vec3 extent = centroids.max - centroids.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                   : (extent.y > extent.z ? 1 : 2);
+    std::nth_element(refs.begin(), refs.begin() + mid, refs.end(),
+                     [axis](Reference const &a, Reference const &b) {
+                       return a.box.center()[axis] < b.box.center()[axis];
+                     });
+    left.assign(refs.begin(), refs.begin() + mid);
+    right.assign(refs.begin() + mid, refs.end());
+  }
+  std::vector<Reference>().swap(refs);
+
+  if (pool && std::min(left.size(), right.size()) >= TASK_REFERENCES) {
+    // idle workers steal the left subtree, or this thread builds it while it
+    // waits
+    ThreadPool::TaskGroup group{*pool};
+    group.run([&]() {
+      node->children[0] = build(std::move(left), depth + 1);
+    });
+    node->children[1] = build(std::move(right), depth + 1);
+    group.wait();
+  } else {
+    node->children[0] = build(std::move(left), depth + 1);
+    node->children[1] = build(std::move(right), depth + 1);
+  }
+  return node;
+}
+
+// the best plane between the bins of one axis. References that enter a bin
+// count on its left, the ones that leave it on its right.
+void Bvh::Builder::sweep(std::array<Bin, SAH_BINS> const &bins, int axis,
+                         bool spatial, Split &best) {
+  std::array<Aabb, SAH_BINS> rightBoxes;
+  std::array<uint32_t, SAH_BINS> rightCounts{};
+  Aabb right;
+  uint32_t nRight = 0;
+  for (uint32_t b = SAH_BINS - 1; b > 0; --b) {
+    right.grow(bins[b].box);
+    nRight += bins[b].exit;
+    rightBoxes[b] = right;
+    rightCounts[b] = nRight;
+  }
+  Aabb left;
+  uint32_t nLeft = 0;
+  for (uint32_t b = 0; b < SAH_BINS - 1; ++b) {
+    left.grow(bins[b].box);
+    nLeft += bins[b].enter;
+    if (nLeft == 0 || rightCounts[b + 1] == 0) {
+      continue;
+    }
+    float cost = left.halfArea() * nLeft +
+                 rightBoxes[b + 1].halfArea() * rightCounts[b + 1];
+    if (cost < best.cost) {
+      best = {cost,  axis, b, spatial, left, rightBoxes[b + 1],
+              nLeft, rightCounts[b + 1]};
+    }
+  }
+}
+
+Bvh::Builder::AxisBins
+Bvh::Builder::mergeBins(std::vector<AxisBins> const &chunkBins) {
+  AxisBins bins = chunkBins[0];
+  for (size_t c = 1; c < chunkBins.size(); ++c) {
+    for (int axis = 0; axis < 3; ++axis) {
+      for (uint32_t b = 0; b < SAH_BINS; ++b) {
+        bins[axis][b].box.grow(chunkBins[c][axis][b].box);
+        bins[axis][b].enter += chunkBins[c][axis][b].enter;
+        bins[axis][b].exit += chunkBins[c][axis][b].exit;
+      }
+    }
+  }
+  return bins;
+}
+
+// bins the references by their centroids, every reference goes to one side
+Bvh::Builder::Split
+Bvh::Builder::objectSplit(std::vector<Reference> const &refs,
+                          Aabb centroids) const {
+  glm::vec3 extent = centroids.max - centroids.min;
+  glm::vec3 scale{0.f};
+  for (int axis = 0; axis < 3; ++axis) {
+    if (extent[axis] > 0.f) {
+      scale[axis] = SAH_BINS / extent[axis];
+    }
+  }
+  unsigned nChunks = chunks(refs.size());
+  std::vector<AxisBins> chunkBins(nChunks);
+  forChunks(refs.size(), nChunks, [&](size_t begin, size_t end, unsigned c) {
+    for (size_t i = begin; i < end; ++i) {
+      glm::vec3 centroid = refs[i].box.center();
+      for (int axis = 0; axis < 3; ++axis) {
+        Bin &bin = chunkBins[c][axis][binIndex(
+            centroid[axis], centroids.min[axis], scale[axis])];
+        bin.box.grow(refs[i].box);
+        bin.enter++;
+        bin.exit++;
+      }
+    }
+  });
+  AxisBins bins = mergeBins(chunkBins);
+
+  Split best;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (extent[axis] > 0.f) {
+      sweep(bins[axis], axis, false, best);
+    }
+  }
+  return best;
+}
+
+// bins the references by their extent, a reference that straddles the plane
+// is split in two, see Stich et al., "Spatial Splits in Bounding Volume
+// Hierarchies"
+Bvh::Builder::Split
+Bvh::Builder::spatialSplit(std::vector<Reference> const &refs,
+                           Aabb bounds) const {
+  glm::vec3 extent = bounds.max - bounds.min;
+  unsigned nChunks = chunks(refs.size());
+  std::vector<AxisBins> chunkBins(nChunks);
+  forChunks(refs.size(), nChunks, [&](size_t begin, size_t end, unsigned c) {
+    for (int axis = 0; axis < 3; ++axis) {
+      if (extent[axis] <= 0.f) {
+        continue;
+      }
+      float width = extent[axis] / SAH_BINS;
+      float scale = SAH_BINS / extent[axis];
+      auto &bins = chunkBins[c][axis];
+      for (size_t i = begin; i < end; ++i) {
+        Reference const &ref = refs[i];
+        uint32_t first = binIndex(ref.box.min[axis], bounds.min[axis], scale);
+        uint32_t last = binIndex(ref.box.max[axis], bounds.min[axis], scale);
+        if (first == last) {
+          bins[first].box.grow(ref.box);
+        } else {
+          for (uint32_t b = first; b <= last; ++b) {
+            float lo = b == first ? ref.box.min[axis]
+                                  : bounds.min[axis] + b * width;
+            float hi = b == last ? ref.box.max[axis]
+                                 : bounds.min[axis] + (b + 1) * width;
+            bins[b].box.grow(clip(ref, axis, lo, hi));
+          }
+        }
+        bins[first].enter++;
+        bins[last].exit++;
+      }
+    }
+  });
+  AxisBins bins = mergeBins(chunkBins);
+
+  Split best;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (extent[axis] > 0.f) {
+      sweep(bins[axis], axis, true, best);
+    }
+  }
+  return best;
+}
+
+void Bvh::Builder::partition(std::vector<Reference> const &refs,
+                             Split const &split, Aabb const &bounds,
+                             Aabb const &centroids,
+                             std::vector<Reference> &left,
+                             std::vector<Reference> &right) const {
+  int axis = split.axis;
+  float min = split.spatial ? bounds.min[axis] : centroids.min[axis];
+  float extent = split.spatial ? bounds.max[axis] - bounds.min[axis]
+                               : centroids.max[axis] - centroids.min[axis];
+  float scale = SAH_BINS / extent;
+  float plane = min + (split.bin + 1) * (extent / SAH_BINS);
+
+  // every chunk partitions into its own halves, they are joined in order
+  unsigned nChunks = chunks(refs.size());
+  std::vector<std::vector<Reference>> chunkLeft(nChunks);
+  std::vector<std::vector<Reference>> chunkRight(nChunks);
+  forChunks(refs.size(), nChunks, [&](size_t begin, size_t end, unsigned c) {
+    for (size_t i = begin; i < end; ++i) {
+      Reference const &ref = refs[i];
+      if (!split.spatial) {
+        if (binIndex(ref.box.center()[axis], min, scale) <= split.bin) {
+          chunkLeft[c].push_back(ref);
+        } else {
+          chunkRight[c].push_back(ref);
+        }
+      } else if (ref.box.max[axis] <= plane) {
+        chunkLeft[c].push_back(ref);
+      } else if (ref.box.min[axis] >= plane) {
+        chunkRight[c].push_back(ref);
+      } else {
+        chunkLeft[c].push_back(
+            {clip(ref, axis, ref.box.min[axis], plane), ref.triangle});
+        chunkRight[c].push_back(
+            {clip(ref, axis, plane, ref.box.max[axis]), ref.triangle});
+      }
+    }
+  });
+  for (unsigned c = 0; c < nChunks; ++c) {
+    left.insert(left.end(), chunkLeft[c].begin(), chunkLeft[c].end());
+    right.insert(right.end(), chunkRight[c].begin(), chunkRight[c].end());
+  }
+}
+
+// bounds of the part of the triangle of ref between lo and hi on the axis
+Aabb Bvh::Builder::clip(Reference const &ref, int axis, float lo,
+                        float hi) const {
+  glm::vec3 const *c = &corners[3 * ref.triangle];
+  Aabb box;
+  for (int i = 0; i < 3; ++i) {
+    glm::vec3 a = c[i];
+    glm::vec3 b = c[(i + 1) % 3];
+    if (a[axis] >= lo && a[axis] <= hi) {
+      box.grow(a);
+    }
+    for (float plane : {lo, hi}) {
+      if ((a[axis] < plane && b[axis] > plane) ||
+          (a[axis] > plane && b[axis] < plane)) {
+        float t = (plane - a[axis]) / (b[axis] - a[axis]);
+        glm::vec3 p = a + t * (b - a);
+        p[axis] = plane;
+        box.grow(p);
+      }
+    }
+  }
+  // the interpolated points are rounded, keep the box conservative
+  glm::vec3 magnitude = glm::max(glm::abs(box.min), glm::abs(box.max));
+  glm::vec3 pad = CLIP_PADDING * magnitude;
+  pad[axis] = 0.f;
+  box.min -= pad;
+  box.max += pad;
+  box = box.intersection(ref.box);
+  box.min[axis] = std::max(box.min[axis], lo);
+  box.max[axis] = std::min(box.max[axis], hi);
+  return box;
+}
+
+Bvh::Bvh(std::vector<glm::vec3> const &corners, BvhOptions const &options) {
+  uint32_t nTriangles = static_cast<uint32_t>(corners.size() / 3);
+  if (nTriangles == 0) {
+    throw std::runtime_error("cannot build a bvh without triangles!");
+  }
+
+  // a build on a given number of threads gets a pool of its own, its workers
+  // and the waiting thread make up nThreads
+  std::unique_ptr<ThreadPool> ownPool;
+  ThreadPool *pool = &ThreadPool::shared();
+  if (options.nThreads == 1) {
+    pool = nullptr;
+  } else if (options.nThreads > 1) {
+    ownPool = std::make_unique<ThreadPool>(options.nThreads - 1);
+    pool = ownPool.get();
+  }
+  Builder builder{corners, options, pool};
+  std::vector<Reference> refs(nTriangles);
+  builder.forChunks(nTriangles, builder.chunks(nTriangles),
+                    [&](size_t begin, size_t end, unsigned) {
+                      for (size_t i = begin; i < end; ++i) {
+                        for (int k = 0; k < 3; ++k) {
+                          refs[i].box.grow(corners[3 * i + k]);
+                        }
+                        refs[i].triangle = static_cast<uint32_t>(i);
+                      }
+                    });
+  std::unique_ptr<BuildNode> root = builder.build(std::move(refs), 0);
+
+  // a binary tree with leaves of at least one triangle has at most 2n - 1
+  // nodes, with full leaves far fewer
+  nodes.reserve(2 * (nTriangles / LEAF_SIZE + 1));
+  blocks.reserve(nTriangles / LEAF_SIZE + 1);
+  flatten(*root, corners);
+}
+
+// stores the subtree depth first, the first child directly after its parent
+uint32_t Bvh::flatten(BuildNode const &buildNode,
+                      std::vector<glm::vec3> const &corners) {
+  uint32_t nodeIdx = static_cast<uint32_t>(nodes.size());
+  nodes.emplace_back();
+  nodes[nodeIdx].min = buildNode.box.min;
+  nodes[nodeIdx].max = buildNode.box.max;
+  if (!buildNode.children[0]) {
+    createLeaf(nodes[nodeIdx], buildNode.triangles, corners);
+    return nodeIdx;
+  }
+  flatten(*buildNode.children[0], corners);
+  uint32_t second = flatten(*buildNode.children[1], corners);
+  nodes[nodeIdx].first = second;
+  nodes[nodeIdx].count = 0;
+  return nodeIdx;
+}
+
+void Bvh::createLeaf(Node &node, std::vector<uint32_t> const &triangles,
+                     std::vector<glm::vec3> const &corners) {
+  node.first = static_cast<uint32_t>(blocks.size());
+  node.count = static_cast<uint32_t>(triangles.size());
+  nReferences += triangles.size();
+  TriangleBlock &block = blocks.emplace_back();
+  for (uint32_t lane = 0; lane < LEAF_SIZE; ++lane) {
+    glm::vec3 v0{0.f}, e1{0.f}, e2{0.f};
+    block.triangle[lane] = NO_HIT;
+    if (lane < triangles.size()) {
+      uint32_t tri = triangles[lane];
+      v0 = corners[3 * tri];
+      e1 = corners[3 * tri + 1] - v0;
+      e2 = corners[3 * tri + 2] - v0;
+      block.triangle[lane] = tri;
+    }
+    for (int k = 0; k < 3; ++k) {
+      block.v0[k][lane] = v0[k];
+      block.e1[k][lane] = e1[k];
+      block.e2[k][lane] = e2[k];
+    }
+  }
+}
+
+Bvh::Hit Bvh::intersect(Ray const &ray) const {
+  Hit hit;
+  float tMax = ray.tMax;
+  glm::vec3 invDir = 1.f / ray.dir;
+  if (boxEntry(nodes[0], ray.ori, invDir, ray.tMin, tMax) ==
+      std::numeric_limits<float>::infinity()) {
+    return hit;
+  }
+
+  uint32_t stack[STACK_SIZE];
+  uint32_t stackSize = 0;
+  uint32_t nodeIdx = 0;
+  while (true) {
+    Node const &node = nodes[nodeIdx];
+    if (node.count > 0) {
+      intersectBlock(blocks[node.first], ray, tMax, hit.triangle);
+    } else {
+      // visit the nearer child first, the farther one may be culled by a
+      // closer hit in the meantime
+      uint32_t near = nodeIdx + 1;
+      uint32_t far = node.first;
+      float tNear = boxEntry(nodes[near], ray.ori, invDir, ray.tMin, tMax);
+      float tFar = boxEntry(nodes[far], ray.ori, invDir, ray.tMin, tMax);
+      if (tFar < tNear) {
+        std::swap(near, far);
+        std::swap(tNear, tFar);
+      }
+      if (tNear != std::numeric_limits<float>::infinity()) {
+        if (tFar != std::numeric_limits<float>::infinity()) {
+          stack[stackSize++] = far;
+        }
+        nodeIdx = near;
+        continue;
+      }
+    }
+    if (stackSize == 0) {
+      break;
+    }
+    nodeIdx = stack[--stackSize];
+  }
+
+  if (hit.triangle != NO_HIT) {
+    hit.t = tMax;
+  }
+  return hit;
+}
+
+void Bvh::intersectPacket(Ray const *rays, uint32_t count,
+                          Hit *hits) const {
+  if (count == 0) {
+    return;
+  }
+  PacketRays packet;
+  for (uint32_t i = 0; i < PACKET_SIZE; ++i) {
+    Ray const &ray = rays[std::min(i, count - 1)];
+    glm::vec3 invDir = 1.f / ray.dir;
+    for (int k = 0; k < 3; ++k) {
+      packet.ori[k][i] = ray.ori[k];
+      packet.invDir[k][i] = invDir[k];
+    }
+    packet.tMin[i] = ray.tMin;
+    packet.tMax[i] = ray.tMax;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    hits[i] = Hit{};
+  }
+
+  struct Entry {
+    uint32_t node;
+    uint32_t mask;
+  };
+  Entry stack[STACK_SIZE];
+  uint32_t stackSize = 0;
+  float entry;
+  uint32_t mask = packetBoxEntry(nodes[0], packet, (1u << count) - 1, entry);
+  uint32_t nodeIdx = 0;
+  while (mask != 0) {
+    Node const &node = nodes[nodeIdx];
+    if (node.count > 0) {
+      for (uint32_t i = 0; i < count; ++i) {
+        if ((mask & (1u << i)) != 0) {
+          intersectBlock(blocks[node.first], rays[i], packet.tMax[i],
+                         hits[i].triangle);
+        }
+      }
+    } else {
+      uint32_t near = nodeIdx + 1;
+      uint32_t far = node.first;
+      float tNear, tFar;
+      uint32_t nearMask = packetBoxEntry(nodes[near], packet, mask, tNear);
+      uint32_t farMask = packetBoxEntry(nodes[far], packet, mask, tFar);
+      if (tFar < tNear) {
+        std::swap(near, far);
+        std::swap(nearMask, farMask);
+      }
+      if (nearMask != 0) {
+        if (farMask != 0) {
+          stack[stackSize++] = {far, farMask};
+        }
+        nodeIdx = near;
+        mask = nearMask;
+        continue;
+      }
+      if (farMask != 0) {
+        nodeIdx = far;
+        mask = farMask;
+        continue;
+      }
+    }
+    if (stackSize == 0) {
+      break;
+    }
+    --stackSize;
+    nodeIdx = stack[stackSize].node;
+    mask = stack[stackSize].mask;
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    if (hits[i].triangle != NO_HIT) {
+      hits[i].t = packet.tMax[i];
+    }
+  }
+}
+
+void Bvh::intersect(std::vector<Ray> const &rays, std::vector<Hit> &hits,
+                    Traversal traversal) const {
+  size_t nRays = rays.size();
+  hits.resize(nRays);
+  if (traversal == TRAVERSAL_SINGLE || traversal == TRAVERSAL_WIDE) {
+    for (size_t i = 0; i < nRays; ++i) {
+      hits[i] = intersect(rays[i]);
+    }
+    return;
+  }
+  if (traversal == TRAVERSAL_PACKET) {
+    for (size_t first = 0; first < nRays; first += PACKET_SIZE) {
+      uint32_t count =
+          static_cast<uint32_t>(std::min<size_t>(PACKET_SIZE, nRays - first));
+      intersectPacket(&rays[first], count, &hits[first]);
+    }
+    return;
+  }
+
+  // counting sort of the rays by direction octant
+  auto octant = [](Ray const &ray) {
+    return (ray.dir.x < 0.f ? 1u : 0u) | (ray.dir.y < 0.f ? 2u : 0u) |
+           (ray.dir.z < 0.f ? 4u : 0u);
+  };
+  std::array<size_t, 9> offsets{};
+  for (auto const &ray : rays) {
+    offsets[octant(ray) + 1]++;
+  }
+  for (size_t o = 1; o < offsets.size(); ++o) {
+    offsets[o] += offsets[o - 1];
+  }
+  std::array<size_t, 8> next{};
+  std::copy(offsets.begin(), offsets.end() - 1, next.begin());
+  std::vector<uint32_t> order(nRays);
+  for (size_t i = 0; i < nRays; ++i) {
+    order[next[octant(rays[i])]++] = static_cast<uint32_t>(i);
+  }
+
+  Ray packet[PACKET_SIZE];
+  Hit packetHits[PACKET_SIZE];
+  for (size_t o = 0; o < 8; ++o) {
+    for (size_t first = offsets[o]; first < offsets[o + 1];
+         first += PACKET_SIZE) {
+      uint32_t count = static_cast<uint32_t>(
+          std::min<size_t>(PACKET_SIZE, offsets[o + 1] - first));
+      for (uint32_t i = 0; i < count; ++i) {
+        packet[i] = rays[order[first + i]];
+      }
+      intersectPacket(packet, count, packetHits);
+      for (uint32_t i = 0; i < count; ++i) {
+        hits[order[first + i]] = packetHits[i];
+      }
+    }
+  }
+}
+
+} // namespace oray
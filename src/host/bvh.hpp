@@ -0,0 +1,119 @@
+#pragma once
+
+#include "commonStructs.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace oray {
+
+// how Bvh::intersect traverses a batch of rays
+enum Traversal : uint32_t {
+  // every ray on its own
+  TRAVERSAL_SINGLE = 0,
+  // consecutive rays in packets of Bvh::PACKET_SIZE
+  TRAVERSAL_PACKET = 1,
+  // packets of rays with the same direction octant
+  TRAVERSAL_STREAM = 2,
+  // every ray on its own through the WideBvh collapsed from the Bvh, which
+  // Bvh::intersect treats like TRAVERSAL_SINGLE
+  TRAVERSAL_WIDE = 3
+};
+
+struct BvhOptions {
+  // threads of the build, 0 for the workers of ThreadPool::shared()
+  unsigned nThreads = 0;
+  // also split triangles that straddle a split plane. Gives tighter boxes
+  // around long thin triangles, at the cost of triangles in several leaves.
+  bool spatialSplits = false;
+};
+
+// bounding volume hierarchy over a world space triangle soup, the
+// acceleration structure of the CPU tracer. Built with binned SAH on several
+// threads, every leaf holds up to LEAF_SIZE triangles in one SIMD block, so a
+// leaf is a single 8 wide (AVX2) or two 4 wide (SSE) ray triangle tests.
+class Bvh {
+public:
+  static constexpr uint32_t LEAF_SIZE = 8;
+  static constexpr uint32_t PACKET_SIZE = 8;
+
+  struct Ray {
+    glm::vec3 ori;
+    glm::vec3 dir;
+    float tMin;
+    float tMax;
+  };
+
+  struct Hit {
+    // index into the corners the Bvh was built from, divided by three
+    uint32_t triangle = NO_HIT;
+    float t = 0.f;
+  };
+
+  struct Node {
+    glm::vec3 min;
+    // leaf: index of its TriangleBlock, inner node: index of the second
+    // child, the first child directly follows its parent
+    uint32_t first;
+    glm::vec3 max;
+    // triangles of a leaf, 0 for inner nodes
+    uint32_t count;
+  };
+
+  // triangles of a leaf as structure of arrays, corner v0 and the edges
+  // e1 = v1 - v0 and e2 = v2 - v0. Unused lanes are degenerate and never hit.
+  struct alignas(32) TriangleBlock {
+    float v0[3][LEAF_SIZE];
+    float e1[3][LEAF_SIZE];
+    float e2[3][LEAF_SIZE];
+    uint32_t triangle[LEAF_SIZE];
+  };
+
+  // corners[3 * i + k] is corner k of triangle i
+  explicit Bvh(std::vector<glm::vec3> const &corners,
+               BvhOptions const &options = {});
+
+  // closest hit in (tMin, tMax), both sides of the triangles count
+  Hit intersect(Ray const &ray) const;
+  // closest hits of up to PACKET_SIZE rays that traverse the tree together.
+  // A node is visited if any of the rays enters it, so the rays should have
+  // similar origins and directions.
+  void intersectPacket(Ray const *rays, uint32_t count, Hit *hits) const;
+  // closest hits of all rays. TRAVERSAL_STREAM sorts the rays by the signs
+  // of their directions first, so packets only hold rays of one octant.
+  void intersect(std::vector<Ray> const &rays, std::vector<Hit> &hits,
+                 Traversal traversal) const;
+
+  glm::vec3 sceneMin() const { return nodes[0].min; };
+  glm::vec3 sceneMax() const { return nodes[0].max; };
+  size_t nodeCount() const { return nodes.size(); };
+  // triangles in all leaves, more than the triangles with spatial splits
+  size_t referenceCount() const { return nReferences; };
+  size_t nodeMemorySize() const { return nodes.size() * sizeof(Node); };
+  size_t memorySize() const {
+    return nodeMemorySize() + blocks.size() * sizeof(TriangleBlock);
+  };
+  std::vector<Node> const &getNodes() const { return nodes; };
+  std::vector<TriangleBlock> const &getBlocks() const { return blocks; };
+
+private:
+  struct Reference;
+  struct BuildNode;
+  class Builder;
+
+  uint32_t flatten(BuildNode const &buildNode,
+                   std::vector<glm::vec3> const &corners);
+  void createLeaf(Node &node, std::vector<uint32_t> const &triangles,
+                  std::vector<glm::vec3> const &corners);
+
+  std::vector<Node> nodes;
+  std::vector<TriangleBlock> blocks;
+  size_t nReferences = 0;
+};
+
+} // namespace oray
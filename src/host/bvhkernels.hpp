@@ -0,0 +1,192 @@
+#pragma once
+
+#include "bvh.hpp"
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ORAY_SSE
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ORAY_SSE
+#endif
+
+// ray triangle kernels shared by the binary and the wide Bvh
+namespace oray {
+namespace kernels {
+
+// Moeller-Trumbore against all lanes of a block, updates tMax and triangle
+// with the closest hit in (tMin, tMax)
+#if defined(__AVX2__)
+inline void intersectBlock(Bvh::TriangleBlock const &block,
+                           Bvh::Ray const &ray, float &tMax,
+                           uint32_t &triangle) {
+  __m256 dx = _mm256_set1_ps(ray.dir.x);
+  __m256 dy = _mm256_set1_ps(ray.dir.y);
+  __m256 dz = _mm256_set1_ps(ray.dir.z);
+  __m256 e1x = _mm256_load_ps(block.e1[0]);
+  __m256 e1y = _mm256_load_ps(block.e1[1]);
+  __m256 e1z = _mm256_load_ps(block.e1[2]);
+  __m256 e2x = _mm256_load_ps(block.e2[0]);
+  __m256 e2y = _mm256_load_ps(block.e2[1]);
+  __m256 e2z = _mm256_load_ps(block.e2[2]);
+
+  __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+  __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+  __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+  __m256 det = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)),
+      _mm256_mul_ps(e1z, pz));
+  __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+
+  __m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.ori.x),
+                            _mm256_load_ps(block.v0[0]));
+  __m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.ori.y),
+                            _mm256_load_ps(block.v0[1]));
+  __m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.ori.z),
+                            _mm256_load_ps(block.v0[2]));
+  __m256 u = _mm256_mul_ps(
+      _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)),
+          _mm256_mul_ps(tz, pz)),
+      invDet);
+
+  __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+  __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+  __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+  __m256 v = _mm256_mul_ps(
+      _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+          _mm256_mul_ps(dz, qz)),
+      invDet);
+  __m256 t = _mm256_mul_ps(
+      _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+          _mm256_mul_ps(e2z, qz)),
+      invDet);
+
+  __m256 zero = _mm256_setzero_ps();
+  __m256 mask = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+  mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+  mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+  mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v),
+                                           _mm256_set1_ps(1.f), _CMP_LE_OQ));
+  mask = _mm256_and_ps(
+      mask, _mm256_cmp_ps(t, _mm256_set1_ps(ray.tMin), _CMP_GT_OQ));
+  mask = _mm256_and_ps(mask,
+                       _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+  int bits = _mm256_movemask_ps(mask);
+  if (bits == 0) {
+    return;
+  }
+  alignas(32) float ts[Bvh::LEAF_SIZE];
+  _mm256_store_ps(ts, t);
+  for (uint32_t i = 0; i < Bvh::LEAF_SIZE; ++i) {
+    if ((bits & (1 << i)) != 0 && ts[i] < tMax) {
+      tMax = ts[i];
+      triangle = block.triangle[i];
+    }
+  }
+}
+#elif defined(ORAY_SSE)
+// lanes [first, first + 4)
+inline void intersectHalfBlock(Bvh::TriangleBlock const &block,
+                               uint32_t first, Bvh::Ray const &ray,
+                               float &tMax, uint32_t &triangle) {
+  __m128 dx = _mm_set1_ps(ray.dir.x);
+  __m128 dy = _mm_set1_ps(ray.dir.y);
+  __m128 dz = _mm_set1_ps(ray.dir.z);
+  __m128 e1x = _mm_load_ps(block.e1[0] + first);
+  __m128 e1y = _mm_load_ps(block.e1[1] + first);
+  __m128 e1z = _mm_load_ps(block.e1[2] + first);
+  __m128 e2x = _mm_load_ps(block.e2[0] + first);
+  __m128 e2y = _mm_load_ps(block.e2[1] + first);
+  __m128 e2z = _mm_load_ps(block.e2[2] + first);
+
+  __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+  __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+  __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+  __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+                          _mm_mul_ps(e1z, pz));
+  __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+  __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.ori.x),
+                         _mm_load_ps(block.v0[0] + first));
+  __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.ori.y),
+                         _mm_load_ps(block.v0[1] + first));
+  __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.ori.z),
+                         _mm_load_ps(block.v0[2] + first));
+  __m128 u = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)),
+                 _mm_mul_ps(tz, pz)),
+      invDet);
+
+  __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+  __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+  __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+  __m128 v = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)),
+                 _mm_mul_ps(dz, qz)),
+      invDet);
+  __m128 t = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+                 _mm_mul_ps(e2z, qz)),
+      invDet);
+
+  __m128 zero = _mm_setzero_ps();
+  __m128 mask = _mm_cmpneq_ps(det, zero);
+  mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+  mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+  mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+  mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, _mm_set1_ps(ray.tMin)));
+  mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(tMax)));
+  int bits = _mm_movemask_ps(mask);
+  if (bits == 0) {
+    return;
+  }
+  alignas(16) float ts[4];
+  _mm_store_ps(ts, t);
+  for (uint32_t i = 0; i < 4; ++i) {
+    if ((bits & (1 << i)) != 0 && ts[i] < tMax) {
+      tMax = ts[i];
+      triangle = block.triangle[first + i];
+    }
+  }
+}
+
+inline void intersectBlock(Bvh::TriangleBlock const &block,
+                           Bvh::Ray const &ray, float &tMax,
+                           uint32_t &triangle) {
+  intersectHalfBlock(block, 0, ray, tMax, triangle);
+  intersectHalfBlock(block, 4, ray, tMax, triangle);
+}
+#else
+inline void intersectBlock(Bvh::TriangleBlock const &block,
+                           Bvh::Ray const &ray, float &tMax,
+                           uint32_t &triangle) {
+  for (uint32_t i = 0; i < Bvh::LEAF_SIZE; ++i) {
+    glm::vec3 e1{block.e1[0][i], block.e1[1][i], block.e1[2][i]};
+    glm::vec3 e2{block.e2[0][i], block.e2[1][i], block.e2[2][i]};
+    glm::vec3 p = glm::cross(ray.dir, e2);
+    float det = glm::dot(e1, p);
+    if (det == 0.f) {
+      continue;
+    }
+    float invDet = 1.f / det;
+    glm::vec3 tv =
+        ray.ori - glm::vec3{block.v0[0][i], block.v0[1][i], block.v0[2][i]};
+    float u = glm::dot(tv, p) * invDet;
+    glm::vec3 q = glm::cross(tv, e1);
+    float v = glm::dot(ray.dir, q) * invDet;
+    float t = glm::dot(e2, q) * invDet;
+    if (u >= 0.f && v >= 0.f && u + v <= 1.f && t > ray.tMin && t < tMax) {
+      tMax = t;
+      triangle = block.triangle[i];
+    }
+  }
+}
+#endif
+
+} // namespace kernels
+} // namespace oray
@@ -1,18 +1,61 @@
+#pragma once
 #include <cstdint>
+#include <glm/glm.hpp>
 #include <vulkan/vulkan_core.h>
 namespace oray {
 
+// keep in sync with Constants in src/shaders/structs.h
 struct RtPushConstants {
-  uint64_t indexBuffer;
-  uint64_t vertexBuffer;
+  uint64_t meshBuffer;
+  uint64_t tri2MeshBuffer;
   uint64_t oriBuffer;
   uint64_t dirBuffer;
-//  uint64_t hitBuffer;
+  uint64_t hitBuffer;
+  uint64_t countBuffer;
+  uint64_t rowBuffer;
+  uint64_t materialBuffer;
   uint64_t triangleIndex;
+  uint64_t nTriangles;
+  uint32_t samplingMode;
+  uint32_t sampler;
+  uint32_t launchIndex;
+  uint32_t traceMode;
+  uint32_t maxBounces;
+  float sceneScale;
+  float tMax;
+  uint32_t seed;
 //  uint64_t nRays;
 //  bool recordOri;
 //  bool recordDir;
 //  bool recordHit;
 };
 
-}
\ No newline at end of file
+// one per OrayObject, see MeshInfo in src/shaders/structs.h
+struct MeshInfo {
+  uint64_t indexBuffer;
+  uint64_t vertexBuffer;
+  glm::mat4 transform;
+  // global index of the first triangle of the object
+  uint32_t triangleOffset;
+  uint32_t padding;
+};
+
+// entry of the row buffer, see RowEntry in src/shaders/structs.h
+struct RowEntry {
+  uint32_t triangle;
+  uint32_t launchIndex;
+};
+
+// marks a ray that did not hit anything in the hit buffer
+constexpr uint32_t NO_HIT = 0xFFFFFFFF;
+
+// direction sampling strategies of raygen.rgen
+enum SamplingMode : uint32_t { SAMPLING_LEGACY = 0, SAMPLING_COSINE = 1 };
+
+// sources of the four random numbers per ray of raygen.rgen
+enum Sampler : uint32_t { SAMPLER_RANDOM = 0, SAMPLER_SOBOL = 1 };
+
+// what the model trace counts, see TRACE_* in src/shaders/structs.h
+enum TraceMode : uint32_t { TRACE_VIEW_FACTORS = 0, TRACE_GEBHART = 1 };
+
+}
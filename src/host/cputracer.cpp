@@ -0,0 +1,350 @@
+#include "cputracer.hpp"
+#include "rayoffset.hpp"
+#include "sampling.hpp"
+#include "threadpool.hpp"
+#include "viewfactors.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+
+namespace oray {
+
+namespace {
+// rays of a row that are generated and traced together
+constexpr uint32_t RAYS_PER_BATCH = 256;
+// rays of a row in one task of the ThreadPool, rows with more rays are split
+constexpr uint32_t RAYS_PER_CHUNK = 16 * RAYS_PER_BATCH;
+
+// barycentric coordinates of corners 1 and 2 at the hit of the ray with the
+// triangle, the hit attributes of closesthit.rchit
+glm::vec2 barycentrics(Bvh::Ray const &ray, glm::vec3 v0, glm::vec3 e1,
+                       glm::vec3 e2) {
+  glm::vec3 p = glm::cross(ray.dir, e2);
+  float invDet = 1.f / glm::dot(e1, p);
+  glm::vec3 s = ray.ori - v0;
+  glm::vec3 q = glm::cross(s, e1);
+  return {glm::dot(s, p) * invDet, glm::dot(ray.dir, q) * invDet};
+}
+} // namespace
+
+CpuTracer::CpuTracer(std::vector<OrayObject> const &orayObjects,
+                     GeometrySources const &sources,
+                     std::shared_ptr<State> state)
+    : CpuTracer(instances(orayObjects, sources), state) {}
+
+std::vector<CpuTracer::Instance>
+CpuTracer::instances(std::vector<OrayObject> const &orayObjects,
+                     GeometrySources const &sources) {
+  std::vector<Instance> result;
+  for (auto const &obj : orayObjects) {
+    auto source = sources.find(obj.geom.get());
+    if (source == sources.end()) {
+      throw std::runtime_error("no builder for the geometry of an object!");
+    }
+    result.push_back({&source->second, obj.transform.mat4(), obj.emissivity});
+  }
+  return result;
+}
+
+CpuTracer::CpuTracer(std::vector<Instance> const &instances,
+                     std::shared_ptr<State> state)
+    : state{state}, sceneInstances{instances} {
+  if (instances.empty()) {
+    throw std::runtime_error("cpu tracer needs at least one object!");
+  }
+  nThreads = ThreadPool::shared().threadCount();
+  buildScene();
+  checkTallySize(nTriangles);
+  resetTallies(Sampling::fromState(*state));
+}
+
+void CpuTracer::buildScene() {
+  corners.clear();
+  emissivities.clear();
+  for (auto const &instance : sceneInstances) {
+    for (uint32_t idx : instance.builder->indices) {
+      glm::vec3 position = instance.builder->vertices[idx].position;
+      corners.push_back(
+          glm::vec3(instance.transform * glm::vec4(position, 1.f)));
+    }
+    emissivities.insert(emissivities.end(),
+                        instance.builder->indices.size() / 3,
+                        instance.emissivity);
+  }
+  nTriangles = static_cast<uint32_t>(corners.size() / 3);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  BvhOptions options{};
+  options.spatialSplits = state->cpuSpatialSplits;
+  bvh = std::make_unique<Bvh>(corners, options);
+  wideBvh = std::make_unique<WideBvh>(*bvh);
+  sceneExtent = rayExtent(bvh->sceneMin(), bvh->sceneMax());
+  bvhBuildTime =
+      std::chrono::duration<float, std::chrono::milliseconds::period>(
+          std::chrono::high_resolution_clock::now() - start)
+          .count();
+}
+
+void CpuTracer::updateInstances(std::vector<OrayObject> const &orayObjects) {
+  if (orayObjects.size() != sceneInstances.size()) {
+    throw std::runtime_error(
+        "instance update cannot add or remove objects, create a new tracer!");
+  }
+  for (size_t i = 0; i < orayObjects.size(); ++i) {
+    sceneInstances[i].transform = orayObjects[i].transform.mat4();
+    sceneInstances[i].emissivity = orayObjects[i].emissivity;
+  }
+  // a flat world space Bvh cannot move its objects, it is built again
+  buildScene();
+  resetTallies(accumulationSampling);
+}
+
+void CpuTracer::updateMaterials(std::vector<OrayObject> const &orayObjects) {
+  if (orayObjects.size() != sceneInstances.size()) {
+    throw std::runtime_error(
+        "material update cannot add or remove objects, create a new tracer!");
+  }
+  // the triangles come from the builders, the objects may have no Geometry
+  emissivities.clear();
+  emissivities.reserve(nTriangles);
+  for (size_t i = 0; i < orayObjects.size(); ++i) {
+    sceneInstances[i].emissivity = orayObjects[i].emissivity;
+    emissivities.insert(emissivities.end(),
+                        sceneInstances[i].builder->indices.size() / 3,
+                        sceneInstances[i].emissivity);
+  }
+  resetTallies(accumulationSampling);
+}
+
+void CpuTracer::resetTallies(Sampling const &sampling) {
+  accumulationSampling = sampling;
+  counts.assign(static_cast<size_t>(nTriangles) * nTriangles, 0);
+  rowLaunches.assign(nTriangles, 0);
+}
+
+void CpuTracer::launch(std::vector<uint32_t> const &triangles) {
+  if (accumulationSampling.nRays == 0 || triangles.empty()) {
+    return;
+  }
+  Settings settings{};
+  static_cast<Sampling &>(settings) = accumulationSampling;
+  settings.traversal = static_cast<Traversal>(state->cpuTraversal);
+
+  std::vector<RowEntry> rows(triangles.size());
+  for (size_t i = 0; i < triangles.size(); ++i) {
+    rows[i] = {triangles[i], rowLaunches[triangles[i]]};
+    rowLaunches[triangles[i]]++;
+  }
+  // like the hit buffer of the Raytracer, only the latest launch is kept
+  modelHits.clear();
+  trace(settings, rows, counts, state->recordRays ? &modelHits : nullptr);
+}
+
+TracingEngine::Tallies CpuTracer::readTallies() {
+  Tallies tallies{};
+  tallies.counts = counts;
+  tallies.rowRays.resize(nTriangles);
+  for (uint32_t src = 0; src < nTriangles; ++src) {
+    tallies.rowRays[src] =
+        static_cast<uint64_t>(accumulationSampling.nRays) * rowLaunches[src];
+  }
+  return tallies;
+}
+
+void CpuTracer::traceModel() {
+  if (state->nRays <= 0) {
+    return;
+  }
+  resetTallies(Sampling::fromState(*state));
+  std::vector<uint32_t> triangles(nTriangles);
+  for (uint32_t i = 0; i < nTriangles; ++i) {
+    triangles[i] = i;
+  }
+  launch(triangles);
+
+  Tallies tallies = readTallies();
+  computeViewFactors(tallies.counts, tallies.rowRays, state->viewFactors,
+                     state->rowErrors);
+  state->accumulatedLaunches = 1;
+}
+
+void CpuTracer::trace(Settings const &settings,
+                      std::vector<RowEntry> const &rows,
+                      std::vector<uint64_t> &counts,
+                      std::vector<uint32_t> *hits) const {
+  counts.resize(static_cast<size_t>(nTriangles) * nTriangles);
+  if (hits) {
+    hits->resize(rows.size() * settings.nRays);
+  }
+
+  // rows cost very different amounts with bounces and ray budgets. They are
+  // cut into chunks of rays that the pool spreads over its workers, so a few
+  // expensive rows cannot keep one worker busy at the end of the trace.
+  uint32_t chunksPerRow =
+      (settings.nRays + RAYS_PER_CHUNK - 1) / RAYS_PER_CHUNK;
+  std::vector<std::mutex> rowMutexes(rows.size());
+  ThreadPool::shared().parallelFor(
+      rows.size() * chunksPerRow, 1, [&](size_t begin, size_t end) {
+        std::vector<uint32_t> targets;
+        for (size_t c = begin; c < end; ++c) {
+          size_t r = c / chunksPerRow;
+          uint32_t first = static_cast<uint32_t>(c % chunksPerRow) *
+                           RAYS_PER_CHUNK;
+          uint32_t last = std::min(settings.nRays, first + RAYS_PER_CHUNK);
+          targets.resize(last - first);
+          traceRays(settings, rows[r], first, last, targets.data());
+
+          if (hits) {
+            std::copy(targets.begin(), targets.end(),
+                      hits->begin() + r * settings.nRays + first);
+          }
+          uint64_t *countRow = counts.data() +
+                               static_cast<size_t>(rows[r].triangle) *
+                                   nTriangles;
+          std::lock_guard<std::mutex> lock{rowMutexes[r]};
+          for (uint32_t target : targets) {
+            if (target != NO_HIT) {
+              countRow[target]++;
+            }
+          }
+        }
+      });
+}
+
+void CpuTracer::intersect(std::vector<Bvh::Ray> const &rays,
+                          std::vector<Bvh::Hit> &hits,
+                          Traversal traversal) const {
+  if (traversal == TRAVERSAL_WIDE) {
+    wideBvh->intersect(rays, hits);
+  } else {
+    bvh->intersect(rays, hits, traversal);
+  }
+}
+
+// the body of raygen.rgen for the rays [first, last) of the row. The rays are
+// traced in batches: all primary rays of a batch, then all rays of the batch
+// that were reflected, and so on, which keeps the packets of Bvh::intersect
+// full.
+void CpuTracer::traceRays(Settings const &settings, RowEntry row,
+                          uint32_t first, uint32_t last,
+                          uint32_t *rayTargets) const {
+  using namespace sampling;
+  uint32_t srcTri = row.triangle;
+  glm::vec3 o_base = corners[3 * srcTri];
+  glm::vec3 base_1 = corners[3 * srcTri + 1] - o_base;
+  glm::vec3 base_2 = corners[3 * srcTri + 2] - o_base;
+  glm::vec3 normal = glm::normalize(glm::cross(base_1, base_2));
+  glm::vec3 base_star = glm::normalize(glm::cross(base_1, normal));
+  glm::vec3 tangent = glm::normalize(base_1);
+  uint32_t sobolSeed = tea(srcTri, settings.seed);
+
+  std::vector<Bvh::Ray> rays;
+  std::vector<Bvh::Hit> hits;
+  std::vector<uint64_t> samples;
+  std::vector<uint32_t> targets;
+  std::vector<uint32_t> bounces;
+  // rays of the batch that still travel, and their next segments
+  std::vector<uint32_t> active;
+  std::vector<Bvh::Ray> bounceRays;
+  std::vector<Bvh::Hit> bounceHits;
+  for (uint32_t start = first; start < last; start += RAYS_PER_BATCH) {
+    uint32_t batch = std::min(RAYS_PER_BATCH, last - start);
+    rays.resize(batch);
+    samples.resize(batch);
+    for (uint32_t i = 0; i < batch; ++i) {
+      samples[i] = static_cast<uint64_t>(row.launchIndex) * settings.nRays +
+                   start + i;
+
+      glm::vec4 u;
+      if (settings.sampler == SAMPLER_SOBOL) {
+        u = sobol4(static_cast<uint32_t>(samples[i]), sobolSeed);
+      } else {
+        u = rayRandom(settings.seed, srcTri, samples[i], 0u);
+      }
+
+      float r = u.x;
+      float s = u.y;
+      if (r + s >= 1) {
+        r = 1 - r;
+        s = 1 - s;
+      }
+      glm::vec3 ori = o_base + base_1 * r + base_2 * s;
+
+      glm::vec3 dir;
+      if (settings.samplingMode == SAMPLING_COSINE) {
+        dir = sampleCosine(u.z, u.w, tangent, base_star, normal);
+      } else {
+        dir = sampleLegacy(u.z, u.w, tangent, base_star, normal);
+      }
+      rays[i] = {offsetRay(ori, normal, sceneExtent.sceneScale), dir, 0.f,
+                 sceneExtent.tMax};
+    }
+    intersect(rays, hits, settings.traversal);
+    targets.resize(batch);
+    for (uint32_t i = 0; i < batch; ++i) {
+      targets[i] = hits[i].triangle;
+    }
+
+    // gray diffuse surfaces, see raygen.rgen
+    if (settings.traceMode == TRACE_GEBHART) {
+      bounces.assign(batch, 0);
+      active.clear();
+      for (uint32_t i = 0; i < batch; ++i) {
+        if (targets[i] != NO_HIT) {
+          active.push_back(i);
+        }
+      }
+      while (!active.empty()) {
+        size_t nReflected = 0;
+        bounceRays.clear();
+        for (uint32_t i : active) {
+          uint32_t target = targets[i];
+          glm::vec4 v =
+              rayRandom(settings.seed, srcTri, samples[i], 1u + bounces[i]);
+          if (v.x < emissivities[target]) {
+            continue;
+          }
+          if (++bounces[i] >= settings.maxBounces) {
+            targets[i] = NO_HIT;
+            continue;
+          }
+          Bvh::Ray &ray = rays[i];
+          glm::vec3 v0 = corners[3 * target];
+          glm::vec3 e1 = corners[3 * target + 1] - v0;
+          glm::vec3 e2 = corners[3 * target + 2] - v0;
+          glm::vec2 b = barycentrics(ray, v0, e1, e2);
+          glm::vec3 hitPos = v0 + b.x * e1 + b.y * e2;
+          glm::vec3 hitNormal = glm::normalize(glm::cross(e1, e2));
+          if (glm::dot(hitNormal, ray.dir) > 0) {
+            hitNormal = -hitNormal;
+          }
+          glm::vec3 hitTangent = glm::normalize(e1);
+          ray.dir = sampleCosine(v.y, v.z, hitTangent,
+                                 glm::cross(hitNormal, hitTangent), hitNormal);
+          ray.ori = offsetRay(hitPos, hitNormal, sceneExtent.sceneScale);
+          active[nReflected++] = i;
+          bounceRays.push_back(ray);
+        }
+        active.resize(nReflected);
+        intersect(bounceRays, bounceHits, settings.traversal);
+
+        nReflected = 0;
+        for (size_t k = 0; k < active.size(); ++k) {
+          uint32_t i = active[k];
+          hits[i] = bounceHits[k];
+          targets[i] = bounceHits[k].triangle;
+          if (targets[i] != NO_HIT) {
+            active[nReflected++] = i;
+          }
+        }
+        active.resize(nReflected);
+      }
+    }
+
+    std::copy(targets.begin(), targets.end(), rayTargets + (start - first));
+  }
+}
+
+} // namespace oray
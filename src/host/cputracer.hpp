@@ -0,0 +1,122 @@
+#pragma once
+
+#include "bvh.hpp"
+#include "commonStructs.h"
+#include "geometry.hpp"
+#include "orayobject.hpp"
+#include "rayoffset.hpp"
+#include "state.hpp"
+#include "tracingengine.hpp"
+#include "widebvh.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace oray {
+
+// traces the rays of raygen.rgen on the host, for machines without a ray
+// tracing GPU. The scene is flattened into one world space Bvh built from the
+// Geometry::Builder data of the objects, triangles are numbered like in the
+// Raytracer. The same samplers and the same sample indices produce the same
+// rays, so the hit and view factor outputs match the GPU ones up to floating
+// point differences of the intersection tests.
+class CpuTracer : public TracingEngine {
+public:
+  // one object of the scene, without the Geometry on the device
+  struct Instance {
+    Geometry::Builder const *builder;
+    glm::mat4 transform{1.f};
+    float emissivity = 1.f;
+  };
+
+  struct Settings : Sampling {
+    Traversal traversal = TRAVERSAL_WIDE;
+  };
+
+  // the sources and builders must outlive the tracer, updateInstances
+  // flattens them again
+  CpuTracer(std::vector<OrayObject> const &orayObjects,
+            GeometrySources const &sources, std::shared_ptr<State> state);
+  // for tools that trace without a Device
+  CpuTracer(std::vector<Instance> const &instances,
+            std::shared_ptr<State> state);
+
+  CpuTracer(const CpuTracer &) = delete;
+  CpuTracer &operator=(const CpuTracer &) = delete;
+
+  char const *name() const override { return "cpu"; };
+  uint32_t triangleCount() const override { return nTriangles; };
+  float buildTime() const override { return bvhBuildTime; };
+
+  // traces state->nRays rays from every triangle and stores the resulting
+  // view factor matrix in state->viewFactors, like Raytracer::traceModel
+  void traceModel() override;
+  // rebuilds the Bvh for the current transforms of the objects
+  void updateInstances(std::vector<OrayObject> const &orayObjects) override;
+  // rewrites the per triangle emissivities from the objects
+  void updateMaterials(std::vector<OrayObject> const &orayObjects) override;
+
+  void resetTallies(Sampling const &sampling) override;
+  // traces with the state->cpuTraversal kernels
+  void launch(std::vector<uint32_t> const &triangles) override;
+  Tallies readTallies() override;
+
+  // traces settings.nRays rays from the triangle of every row, continuing
+  // its sample sequence at row.launchIndex like the rows of a GPU launch, and
+  // adds the hits to counts[triangle * triangleCount() + target]. Every
+  // triangle may appear in one row only. The rows are traced in parallel on
+  // ThreadPool::shared().
+  // With hits, the target of ray x of row r is written to
+  // (*hits)[r * settings.nRays + x].
+  void trace(Settings const &settings, std::vector<RowEntry> const &rows,
+             std::vector<uint64_t> &counts,
+             std::vector<uint32_t> *hits = nullptr) const;
+
+  // per ray hit triangles of the last launch, only with state->recordRays
+  std::vector<uint32_t> readHitBuffer() const { return modelHits; };
+  unsigned threadCount() const { return nThreads; };
+  Bvh const &getBvh() const { return *bvh; };
+  WideBvh const &getWideBvh() const { return *wideBvh; };
+
+  std::shared_ptr<State> state;
+
+private:
+  static std::vector<Instance>
+  instances(std::vector<OrayObject> const &orayObjects,
+            GeometrySources const &sources);
+  // flattens the instances into corners and builds the Bvh over them
+  void buildScene();
+  // writes the hit triangle of every ray to rayTargets
+  void traceRays(Settings const &settings, RowEntry row, uint32_t first,
+                 uint32_t last, uint32_t *rayTargets) const;
+  void intersect(std::vector<Bvh::Ray> const &rays,
+                 std::vector<Bvh::Hit> &hits, Traversal traversal) const;
+
+  std::vector<Instance> sceneInstances;
+  uint32_t nTriangles = 0;
+  unsigned nThreads = 1;
+  // world space corners, three per triangle
+  std::vector<glm::vec3> corners;
+  std::vector<float> emissivities;
+  std::unique_ptr<Bvh> bvh;
+  std::unique_ptr<WideBvh> wideBvh;
+  // of the Bvh and the WideBvh
+  float bvhBuildTime = 0.f;
+  // from the bounds of the Bvh, like the push constants of the Raytracer
+  RayExtent sceneExtent{};
+  std::vector<uint32_t> modelHits;
+
+  // tallies since the last resetTallies, 64 bits do not wrap however many
+  // launches accumulate
+  Sampling accumulationSampling{};
+  std::vector<uint64_t> counts;
+  // launches every source triangle received
+  std::vector<uint32_t> rowLaunches;
+};
+
+} // namespace oray
@@ -1,6 +1,7 @@
 #include "device.hpp"
 
 // std headers
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <set>
@@ -44,7 +45,7 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance,
 }
 
 // class member functions
-Device::Device(Window &window) : window{window} {
+Device::Device(Window &window) : window{&window} {
   createInstance();
   setupDebugMessenger();
   createSurface();
@@ -53,7 +54,16 @@ Device::Device(Window &window) : window{window} {
   createCommandPool();
 }
 
+Device::Device() {
+  createInstance();
+  setupDebugMessenger();
+  pickPhysicalDevice();
+  createLogicalDevice();
+  createCommandPool();
+}
+
 Device::~Device() {
+  vkDestroyCommandPool(device_, computeCommandPool, nullptr);
   vkDestroyCommandPool(device_, commandPool, nullptr);
   vkDestroyDevice(device_, nullptr);
 
@@ -61,7 +71,9 @@ Device::~Device() {
     DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
   }
 
-  vkDestroySurfaceKHR(instance, surface_, nullptr);
+  if (surface_ != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(instance, surface_, nullptr);
+  }
   vkDestroyInstance(instance, nullptr);
 }
 
@@ -135,24 +147,30 @@ void Device::createLogicalDevice() {
   QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily,
-                                            indices.presentFamily};
+  std::set<uint32_t> uniqueQueueFamilies = {
+      indices.graphicsFamily, indices.presentFamily, indices.computeFamily};
 
-  float queuePriority = 1.0f;
+  // the compute queue may be the second queue of the graphics family
+  float queuePriorities[] = {1.0f, 1.0f};
   for (uint32_t queueFamily : uniqueQueueFamilies) {
     VkDeviceQueueCreateInfo queueCreateInfo = {};
     queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     queueCreateInfo.queueFamilyIndex = queueFamily;
-    queueCreateInfo.queueCount = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+    queueCreateInfo.queueCount =
+        queueFamily == indices.computeFamily ? indices.computeQueueIndex + 1
+                                             : 1;
+    queueCreateInfo.pQueuePriorities = queuePriorities;
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
   // create raytracing pNext chain
   VkPhysicalDeviceFeatures2 features2{
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
-  features2.features.wideLines = VK_TRUE;
-  features2.features.samplerAnisotropy = VK_TRUE;
+  // only drawing needs them
+  if (!isHeadless()) {
+    features2.features.wideLines = VK_TRUE;
+    features2.features.samplerAnisotropy = VK_TRUE;
+  }
   /*
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
@@ -188,9 +206,9 @@ void Device::createLogicalDevice() {
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
   createInfo.pEnabledFeatures = NULL;
-  createInfo.enabledExtensionCount =
-      static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  std::vector<const char *> extensions = getDeviceExtensions();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
 
   // might not really be necessary anymore because device specific validation
   // layers have been deprecated
@@ -209,31 +227,49 @@ void Device::createLogicalDevice() {
 
   vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphicsQueue_);
   vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+  vkGetDeviceQueue(device_, indices.computeFamily, indices.computeQueueIndex,
+                   &computeQueue_);
+  if (indices.computeFamily != indices.graphicsFamily) {
+    bufferQueueFamilies = {indices.graphicsFamily, indices.computeFamily};
+  }
+  std::cout << "compute queue: family " << indices.computeFamily << ", index "
+            << indices.computeQueueIndex
+            << (hasAsyncCompute() ? "" : " (shared with graphics)")
+            << std::endl;
 }
 
 void Device::createCommandPool() {
   QueueFamilyIndices queueFamilyIndices = findPhysicalQueueFamilies();
+  commandPool = createCommandPool(queueFamilyIndices.graphicsFamily);
+  computeCommandPool = createCommandPool(queueFamilyIndices.computeFamily);
+}
 
+VkCommandPool Device::createCommandPool(uint32_t queueFamily) {
   VkCommandPoolCreateInfo poolInfo = {};
   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+  poolInfo.queueFamilyIndex = queueFamily;
   poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
                    VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-  if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool) !=
-      VK_SUCCESS) {
+  VkCommandPool pool;
+  if (vkCreateCommandPool(device_, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
     throw std::runtime_error("failed to create command pool!");
   }
+  return pool;
 }
 
 void Device::createSurface() {
-  window.createWindowSurface(instance, &surface_);
+  window->createWindowSurface(instance, &surface_);
 }
 
 bool Device::isDeviceSuitable(VkPhysicalDevice device) {
   QueueFamilyIndices indices = findQueueFamilies(device);
 
   bool extensionsSupported = checkDeviceExtensionSupport(device);
+  if (isHeadless()) {
+    return indices.isComplete() && extensionsSupported &&
+           supportsRayTracing(device);
+  }
 
   bool swapChainAdequate = false;
   if (extensionsSupported) {
@@ -246,7 +282,24 @@ bool Device::isDeviceSuitable(VkPhysicalDevice device) {
   vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
   return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-         supportedFeatures.samplerAnisotropy;
+         supportedFeatures.samplerAnisotropy && supportsRayTracing(device);
+}
+
+bool Device::supportsRayTracing(VkPhysicalDevice device) {
+  VkPhysicalDeviceVulkan12Features features12{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR asFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
+  asFeatures.pNext = &features12;
+  VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR};
+  rtFeatures.pNext = &asFeatures;
+  VkPhysicalDeviceFeatures2 features2{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+  features2.pNext = &rtFeatures;
+  vkGetPhysicalDeviceFeatures2(device, &features2);
+  return rtFeatures.rayTracingPipeline && asFeatures.accelerationStructure &&
+         features12.bufferDeviceAddress;
 }
 
 void Device::populateDebugMessengerCreateInfo(
@@ -299,12 +352,14 @@ bool Device::checkValidationLayerSupport() {
 }
 
 std::vector<const char *> Device::getRequiredExtensions() {
-  uint32_t glfwExtensionCount = 0;
-  const char **glfwExtensions;
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-  std::vector<const char *> extensions(glfwExtensions,
-                                       glfwExtensions + glfwExtensionCount);
+  std::vector<const char *> extensions;
+  // the surface extensions, GLFW is not initialized without a window
+  if (!isHeadless()) {
+    uint32_t glfwExtensionCount = 0;
+    const char **glfwExtensions;
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+  }
 
   if (enableValidationLayers) {
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -313,6 +368,14 @@ std::vector<const char *> Device::getRequiredExtensions() {
   return extensions;
 }
 
+std::vector<const char *> Device::getDeviceExtensions() {
+  std::vector<const char *> extensions = deviceExtensions;
+  if (!isHeadless()) {
+    extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
+  return extensions;
+}
+
 void Device::hasGflwRequiredInstanceExtensions() {
   uint32_t extensionCount = 0;
   vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
@@ -346,8 +409,9 @@ bool Device::checkDeviceExtensionSupport(VkPhysicalDevice device) {
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                        availableExtensions.data());
 
-  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                           deviceExtensions.end());
+  std::vector<const char *> extensions = getDeviceExtensions();
+  std::set<std::string> requiredExtensions(extensions.begin(),
+                                           extensions.end());
 
   for (const auto &extension : availableExtensions) {
     requiredExtensions.erase(extension.extensionName);
@@ -366,6 +430,23 @@ QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
   vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
                                            queueFamilies.data());
 
+  if (isHeadless()) {
+    // ray tracing commands run on compute queues, nothing is presented
+    for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+      if (queueFamilies[i].queueCount > 0 &&
+          queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+        indices.graphicsFamily = i;
+        indices.presentFamily = i;
+        indices.computeFamily = i;
+        indices.graphicsFamilyHasValue = true;
+        indices.presentFamilyHasValue = true;
+        indices.computeFamilyHasValue = true;
+        break;
+      }
+    }
+    return indices;
+  }
+
   int i = 0;
   for (const auto &queueFamily : queueFamilies) {
     if (queueFamily.queueCount > 0 &&
@@ -379,13 +460,33 @@ QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
       indices.presentFamily = i;
       indices.presentFamilyHasValue = true;
     }
-    if (indices.isComplete()) {
+    if (indices.graphicsFamilyHasValue && indices.presentFamilyHasValue) {
       break;
     }
 
     i++;
   }
+  if (!indices.graphicsFamilyHasValue) {
+    return indices;
+  }
 
+  // prefer a family without graphics, its queues run beside the graphics
+  // queue on most GPUs
+  for (uint32_t family = 0; family < queueFamilyCount; ++family) {
+    VkQueueFlags flags = queueFamilies[family].queueFlags;
+    if (queueFamilies[family].queueCount > 0 &&
+        flags & VK_QUEUE_COMPUTE_BIT && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+      indices.computeFamily = family;
+      indices.computeFamilyHasValue = true;
+      return indices;
+    }
+  }
+  // graphics families support compute as well
+  indices.computeFamily = indices.graphicsFamily;
+  indices.computeFamilyHasValue = true;
+  if (queueFamilies[indices.graphicsFamily].queueCount > 1) {
+    indices.computeQueueIndex = 1;
+  }
   return indices;
 }
 
@@ -447,6 +548,27 @@ uint32_t Device::findMemoryType(uint32_t typeFilter,
   throw std::runtime_error("failed to find suitable memory type!");
 }
 
+VkDeviceSize Device::maxBufferSize(VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceVulkan11Properties properties11{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_PROPERTIES};
+  VkPhysicalDeviceProperties2 properties2{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+  properties2.pNext = &properties11;
+  vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+  VkPhysicalDeviceMemoryProperties memProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+  VkDeviceSize largestHeap = 0;
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+    VkMemoryType const &type = memProperties.memoryTypes[i];
+    if ((type.propertyFlags & properties) == properties) {
+      largestHeap = std::max(largestHeap,
+                             memProperties.memoryHeaps[type.heapIndex].size);
+    }
+  }
+  return std::min(largestHeap, properties11.maxMemoryAllocationSize);
+}
+
 void Device::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                           VkMemoryPropertyFlags properties, VkBuffer &buffer,
                           VkDeviceMemory &bufferMemory, bool addressable) {
@@ -454,7 +576,14 @@ void Device::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
   bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   bufferInfo.size = size;
   bufferInfo.usage = usage;
-  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (bufferQueueFamilies.empty()) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  } else {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount =
+        static_cast<uint32_t>(bufferQueueFamilies.size());
+    bufferInfo.pQueueFamilyIndices = bufferQueueFamilies.data();
+  }
 
   if (vkCreateBuffer(device_, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
     throw std::runtime_error("failed to create vertex buffer!");
@@ -485,10 +614,18 @@ void Device::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
 }
 
 VkCommandBuffer Device::beginSingleTimeCommands() {
+  return beginCommands(commandPool);
+}
+
+VkCommandBuffer Device::beginComputeCommands() {
+  return beginCommands(computeCommandPool);
+}
+
+VkCommandBuffer Device::beginCommands(VkCommandPool pool) {
   VkCommandBufferAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = commandPool;
+  allocInfo.commandPool = pool;
   allocInfo.commandBufferCount = 1;
 
   VkCommandBuffer commandBuffer;
@@ -516,6 +653,37 @@ void Device::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
   vkFreeCommandBuffers(device_, commandPool, 1, &commandBuffer);
 }
 
+void Device::submitSingleTimeCommands(VkCommandBuffer commandBuffer) {
+  submitAndWait(graphicsQueue_, commandPool, commandBuffer);
+}
+
+void Device::submitComputeCommands(VkCommandBuffer commandBuffer) {
+  submitAndWait(computeQueue_, computeCommandPool, commandBuffer);
+}
+
+void Device::submitAndWait(VkQueue queue, VkCommandPool pool,
+                           VkCommandBuffer commandBuffer) {
+  vkEndCommandBuffer(commandBuffer);
+
+  VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+  VkFence fence;
+  if (vkCreateFence(device_, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create submission fence!");
+  }
+
+  VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+    vkDestroyFence(device_, fence, nullptr);
+    throw std::runtime_error("failed to submit command buffer!");
+  }
+  vkWaitForFences(device_, 1, &fence, VK_TRUE, UINT64_MAX);
+
+  vkDestroyFence(device_, fence, nullptr);
+  vkFreeCommandBuffers(device_, pool, 1, &commandBuffer);
+}
+
 void Device::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
                         VkDeviceSize size) {
   VkCommandBuffer commandBuffer = beginSingleTimeCommands();
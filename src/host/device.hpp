@@ -17,9 +17,18 @@ struct SwapChainSupportDetails {
 struct QueueFamilyIndices {
   uint32_t graphicsFamily;
   uint32_t presentFamily;
+  // ray tracing and acceleration structure builds, a family without graphics
+  // if the device has one. Otherwise the graphics family, with a queue of its
+  // own when the family has more than one.
+  uint32_t computeFamily;
+  uint32_t computeQueueIndex = 0;
   bool graphicsFamilyHasValue = false;
   bool presentFamilyHasValue = false;
-  bool isComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
+  bool computeFamilyHasValue = false;
+  bool isComplete() {
+    return graphicsFamilyHasValue && presentFamilyHasValue &&
+           computeFamilyHasValue;
+  }
 };
 
 class Device {
@@ -31,6 +40,10 @@ public:
 #endif
 
   Device(Window &window);
+  // headless: no GLFW, surface or swapchain. Picks the first device that can
+  // trace rays, graphicsQueue and computeQueue are then the same compute
+  // queue. Nothing can be presented, the Renderer cannot be used.
+  Device();
   ~Device();
 
   // Not copyable or movable
@@ -40,18 +53,29 @@ public:
   Device &operator=(Device &&) = delete;
 
   VkCommandPool getCommandPool() { return commandPool; }
+  // for command buffers submitted to the compute queue
+  VkCommandPool getComputeCommandPool() { return computeCommandPool; }
   VkDevice device() { return device_; }
   VkSurfaceKHR surface() { return surface_; }
   VkInstance getInstance() const { return instance; }
   VkPhysicalDevice getPhysicalDevice() const { return physicalDevice;}
   VkQueue graphicsQueue() { return graphicsQueue_; }
   VkQueue presentQueue() { return presentQueue_; }
+  // ray tracing launches and acceleration structure builds run here, so long
+  // traces do not hold up the frames on the graphics queue
+  VkQueue computeQueue() { return computeQueue_; }
+  // true if compute submissions can overlap the graphics queue
+  bool hasAsyncCompute() const { return computeQueue_ != graphicsQueue_; }
+  bool isHeadless() const { return window == nullptr; }
 
   SwapChainSupportDetails getSwapChainSupport() {
     return querySwapChainSupport(physicalDevice);
   }
   uint32_t findMemoryType(uint32_t typeFilter,
                           VkMemoryPropertyFlags properties);
+  // largest single buffer with these memory properties, limited by
+  // maxMemoryAllocationSize and the largest heap that has them
+  VkDeviceSize maxBufferSize(VkMemoryPropertyFlags properties);
   QueueFamilyIndices findPhysicalQueueFamilies() {
     return findQueueFamilies(physicalDevice);
   }
@@ -66,6 +90,12 @@ public:
                     bool addressable = false);
   VkCommandBuffer beginSingleTimeCommands();
   void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+  // like endSingleTimeCommands, but waits on a fence for this submission
+  // instead of idling the whole queue
+  void submitSingleTimeCommands(VkCommandBuffer commandBuffer);
+  // the same on the compute queue, blocks until the commands finished
+  VkCommandBuffer beginComputeCommands();
+  void submitComputeCommands(VkCommandBuffer commandBuffer);
   void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
   void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
                          uint32_t height, uint32_t layerCount);
@@ -83,10 +113,18 @@ private:
   void pickPhysicalDevice();
   void createLogicalDevice();
   void createCommandPool();
+  VkCommandPool createCommandPool(uint32_t queueFamily);
+  VkCommandBuffer beginCommands(VkCommandPool pool);
+  void submitAndWait(VkQueue queue, VkCommandPool pool,
+                     VkCommandBuffer commandBuffer);
 
   // helper functions
   bool isDeviceSuitable(VkPhysicalDevice device);
+  // acceleration structure, ray tracing pipeline and buffer device address
+  // features, which the Raytracer needs
+  bool supportsRayTracing(VkPhysicalDevice device);
   std::vector<const char *> getRequiredExtensions();
+  std::vector<const char *> getDeviceExtensions();
   bool checkValidationLayerSupport();
   QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
   void populateDebugMessengerCreateInfo(
@@ -98,18 +136,24 @@ private:
   VkInstance instance;
   VkDebugUtilsMessengerEXT debugMessenger;
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-  Window &window;
+  // nullptr for a headless device
+  Window *window = nullptr;
   VkCommandPool commandPool;
+  VkCommandPool computeCommandPool;
 
   VkDevice device_;
-  VkSurfaceKHR surface_;
+  VkSurfaceKHR surface_ = VK_NULL_HANDLE;
   VkQueue graphicsQueue_;
   VkQueue presentQueue_;
+  VkQueue computeQueue_;
+  // graphics and compute family if they differ. Buffers are then shared
+  // concurrently, so both queues use them without ownership transfers.
+  std::vector<uint32_t> bufferQueueFamilies;
 
   const std::vector<const char *> validationLayers = {
       "VK_LAYER_KHRONOS_validation"};
+  // a device with a window adds the swapchain extension
   const std::vector<const char *> deviceExtensions = {
-      VK_KHR_SWAPCHAIN_EXTENSION_NAME,
       VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
       VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
       VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME};
@@ -28,6 +28,13 @@ VulkanFunctions::VulkanFunctions(VkDevice device) {
   vkGetRayTracingShaderGroupHandlesKHR =
       reinterpret_cast<PFN_vkGetRayTracingShaderGroupHandlesKHR>(
           vkGetDeviceProcAddr(device, "vkGetRayTracingShaderGroupHandlesKHR"));
+  vkCmdWriteAccelerationStructuresPropertiesKHR =
+      reinterpret_cast<PFN_vkCmdWriteAccelerationStructuresPropertiesKHR>(
+          vkGetDeviceProcAddr(device,
+                              "vkCmdWriteAccelerationStructuresPropertiesKHR"));
+  vkCmdCopyAccelerationStructureKHR =
+      reinterpret_cast<PFN_vkCmdCopyAccelerationStructureKHR>(
+          vkGetDeviceProcAddr(device, "vkCmdCopyAccelerationStructureKHR"));
 }
 
 VulkanFunctions::~VulkanFunctions() {
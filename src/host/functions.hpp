@@ -14,5 +14,7 @@ public:
   PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR;
   PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR;
   PFN_vkGetRayTracingShaderGroupHandlesKHR vkGetRayTracingShaderGroupHandlesKHR;
+  PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR;
+  PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR;
 };
 }
\ No newline at end of file
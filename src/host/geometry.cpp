@@ -1,13 +1,16 @@
 #include "geometry.hpp"
 #include "buffer.hpp"
 #include "device.hpp"
+#include "threadpool.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <unordered_map>
 #include <vulkan/vulkan_core.h>
 
@@ -30,10 +33,20 @@ template <> struct hash<oray::Geometry::TriangleVertex> {
 namespace oray {
 using std::vector;
 
+namespace {
+// indices of one loadModel task, whole triangles
+constexpr size_t INDICES_PER_RANGE = 3 << 14;
+} // namespace
+
 Geometry::Geometry(Device &device, const Geometry::Builder &builder)
     : device(device) {
   createVertexBuffers(builder.vertices);
   createIndexBuffers(builder.indices);
+  std::vector<glm::vec3> positions;
+  for (const auto &vertex : builder.vertices) {
+    positions.push_back(vertex.position);
+  }
+  updateBounds(positions);
 }
 
 Geometry::~Geometry() {}
@@ -68,6 +81,7 @@ void Geometry::createVertexBuffers(
   vertexBuffer = std::make_unique<Buffer>(
       device, vertexSize, vertexCount,
       VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
@@ -75,6 +89,54 @@ void Geometry::createVertexBuffers(
                     bufferSize);
 }
 
+void Geometry::updateBounds(const std::vector<glm::vec3> &positions) {
+  boundsMin = positions[0];
+  boundsMax = positions[0];
+  for (const auto &position : positions) {
+    boundsMin = glm::min(boundsMin, position);
+    boundsMax = glm::max(boundsMax, position);
+  }
+}
+
+Geometry::TriangleVertex *Geometry::mappedVertices() {
+  // created on the first update, static geometry does not pay for it
+  if (!vertexStagingBuffer) {
+    vertexStagingBuffer = std::make_unique<Buffer>(
+        device, sizeof(TriangleVertex), vertexCount,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vertexStagingBuffer->map();
+    device.copyBuffer(vertexBuffer->getBuffer(),
+                      vertexStagingBuffer->getBuffer(),
+                      vertexStagingBuffer->getBufferSize());
+  }
+  return static_cast<TriangleVertex *>(
+      vertexStagingBuffer->getMappedMemory());
+}
+
+void Geometry::updatePositions(const std::vector<glm::vec3> &positions) {
+  if (positions.size() != vertexCount) {
+    throw std::runtime_error("position count does not match vertex count!");
+  }
+  TriangleVertex *vertices = mappedVertices();
+  for (uint32_t i = 0; i < vertexCount; ++i) {
+    vertices[i].position = positions[i];
+  }
+  device.copyBuffer(vertexStagingBuffer->getBuffer(), vertexBuffer->getBuffer(),
+                    vertexStagingBuffer->getBufferSize());
+  updateBounds(positions);
+}
+
+std::vector<glm::vec3> Geometry::getPositions() {
+  TriangleVertex const *vertices = mappedVertices();
+  std::vector<glm::vec3> positions(vertexCount);
+  for (uint32_t i = 0; i < vertexCount; ++i) {
+    positions[i] = vertices[i].position;
+  }
+  return positions;
+}
+
 void Geometry::createIndexBuffers(const std::vector<uint32_t> &indices) {
   indexCount = static_cast<uint32_t>(indices.size());
   hasIndexBuffer = indexCount > 0;
@@ -191,46 +253,94 @@ void Geometry::Builder::loadModel(const std::string &filePath) {
   vertices.clear();
   indices.clear();
 
-  std::unordered_map<TriangleVertex, uint32_t> uniqueVertices{};
-
+  // the indices of all shapes are cut into ranges that are assembled in
+  // parallel, each with a vertex map of its own. Merging the ranges in order
+  // numbers the vertices like a single pass would, and only hashes the
+  // vertices that are unique within their range.
+  struct IndexRange {
+    tinyobj::shape_t const *shape;
+    size_t begin;
+    size_t end;
+  };
+  std::vector<IndexRange> ranges;
   for (const auto &shape : shapes) {
-    for (const auto &index : shape.mesh.indices) {
-      TriangleVertex vertex{};
-
-      if (index.vertex_index >= 0) {
-        vertex.position = {
-            attrib.vertices[3 * index.vertex_index + 0],
-            attrib.vertices[3 * index.vertex_index + 1],
-            attrib.vertices[3 * index.vertex_index + 2],
-        };
-
-        vertex.color = {
-            attrib.colors[3 * index.vertex_index + 0],
-            attrib.colors[3 * index.vertex_index + 1],
-            attrib.colors[3 * index.vertex_index + 2],
-        };
-      }
-
-      if (index.normal_index >= 0) {
-        vertex.normal = {
-            attrib.normals[3 * index.normal_index + 0],
-            attrib.normals[3 * index.normal_index + 1],
-            attrib.normals[3 * index.normal_index + 2],
-        };
-      }
-
-      if (index.texcoord_index >= 0) {
-        vertex.uv = {
-            attrib.texcoords[2 * index.texcoord_index + 0],
-            attrib.texcoords[2 * index.texcoord_index + 1],
-        };
+    size_t nIndices = shape.mesh.indices.size();
+    for (size_t begin = 0; begin < nIndices; begin += INDICES_PER_RANGE) {
+      ranges.push_back(
+          {&shape, begin, std::min(nIndices, begin + INDICES_PER_RANGE)});
+    }
+  }
+  struct RangeMesh {
+    std::vector<TriangleVertex> vertices;
+    std::vector<uint32_t> indices;
+  };
+  std::vector<RangeMesh> meshes(ranges.size());
+  ThreadPool::shared().parallelFor(ranges.size(), 1, [&](size_t first,
+                                                         size_t last) {
+    for (size_t r = first; r < last; ++r) {
+      RangeMesh &mesh = meshes[r];
+      const auto &shapeIndices = ranges[r].shape->mesh.indices;
+      std::unordered_map<TriangleVertex, uint32_t> rangeVertices{};
+      for (size_t i = ranges[r].begin; i < ranges[r].end; ++i) {
+        const auto &index = shapeIndices[i];
+        TriangleVertex vertex{};
+
+        if (index.vertex_index >= 0) {
+          vertex.position = {
+              attrib.vertices[3 * index.vertex_index + 0],
+              attrib.vertices[3 * index.vertex_index + 1],
+              attrib.vertices[3 * index.vertex_index + 2],
+          };
+
+          vertex.color = {
+              attrib.colors[3 * index.vertex_index + 0],
+              attrib.colors[3 * index.vertex_index + 1],
+              attrib.colors[3 * index.vertex_index + 2],
+          };
+        }
+
+        if (index.normal_index >= 0) {
+          vertex.normal = {
+              attrib.normals[3 * index.normal_index + 0],
+              attrib.normals[3 * index.normal_index + 1],
+              attrib.normals[3 * index.normal_index + 2],
+          };
+        }
+
+        if (index.texcoord_index >= 0) {
+          vertex.uv = {
+              attrib.texcoords[2 * index.texcoord_index + 0],
+              attrib.texcoords[2 * index.texcoord_index + 1],
+          };
+        }
+
+        if (rangeVertices.count(vertex) == 0) {
+          rangeVertices[vertex] = static_cast<uint32_t>(mesh.vertices.size());
+          mesh.vertices.push_back(vertex);
+        }
+        mesh.indices.push_back(rangeVertices[vertex]);
       }
+    }
+  });
 
+  size_t nIndices = 0;
+  for (const auto &mesh : meshes) {
+    nIndices += mesh.indices.size();
+  }
+  indices.reserve(nIndices);
+  std::unordered_map<TriangleVertex, uint32_t> uniqueVertices{};
+  for (const auto &mesh : meshes) {
+    std::vector<uint32_t> remap(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+      const TriangleVertex &vertex = mesh.vertices[i];
       if (uniqueVertices.count(vertex) == 0) {
         uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
         vertices.push_back(vertex);
       }
-      indices.push_back(uniqueVertices[vertex]);
+      remap[i] = uniqueVertices[vertex];
+    }
+    for (uint32_t index : mesh.indices) {
+      indices.push_back(remap[index]);
     }
   }
 }
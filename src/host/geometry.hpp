@@ -60,6 +60,21 @@ public:
   void draw(VkCommandBuffer commandBuffer);
 
   uint32_t getIndexCount() { return indexCount; };
+  uint32_t getVertexCount() { return vertexCount; };
+
+  // geometry that changes after its BLAS has been built. The Raytracer builds
+  // it for short build times and refits instead of fast tracing and skips
+  // compaction.
+  bool isDynamic() const { return dynamic; };
+  void setDynamic(bool isDynamic) { dynamic = isDynamic; };
+
+  // overwrites the vertex positions in the device local vertex buffer, the
+  // other attributes are kept. Call Raytracer::refitBLAS afterwards.
+  void updatePositions(const std::vector<glm::vec3> &positions);
+  std::vector<glm::vec3> getPositions();
+  // object space bounds of the vertices
+  glm::vec3 getBoundsMin() const { return boundsMin; };
+  glm::vec3 getBoundsMax() const { return boundsMax; };
 
   VkDeviceAddress getIndexBufferAddress();
   VkDeviceAddress getVertexBufferAddress();
@@ -67,13 +82,21 @@ public:
 private:
   void createVertexBuffers(const std::vector<TriangleVertex> &vertices);
   void createIndexBuffers(const std::vector<uint32_t> &indices);
+  TriangleVertex *mappedVertices();
+  void updateBounds(const std::vector<glm::vec3> &positions);
 
   Device &device;
   std::unique_ptr<Buffer> vertexBuffer;
+  // persistently mapped copy of the vertex buffer, only for position updates
+  std::unique_ptr<Buffer> vertexStagingBuffer;
   uint32_t vertexCount;
+  glm::vec3 boundsMin{0.f};
+  glm::vec3 boundsMax{0.f};
 
   bool hasIndexBuffer = false;
   std::unique_ptr<Buffer> indexBuffer;
   uint32_t indexCount;
+
+  bool dynamic = false;
 };
 } // namespace oray
\ No newline at end of file
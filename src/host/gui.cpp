@@ -4,6 +4,7 @@
 #include "imgui_impl_vulkan.h"
 #include "implot.h"
 #include "state.hpp"
+#include <algorithm>
 #include <stdexcept>
 
 
@@ -41,12 +42,60 @@ void Gui::recordImGuiCommands(VkCommandBuffer buffer, uint32_t imgIdx,
   ImGui::Begin("Test");
   ImGui::SliderFloat("Line Width", &state->lineWidth, 0.2f, 10.f);
   state->doTrace |= ImGui::SliderInt("nRays", &state->nRays, 0, 5000);
+  state->doTrace |=
+      ImGui::Combo("sampling", &state->samplingMode, "legacy\0cosine\0");
+  state->doTrace |=
+      ImGui::Combo("sampler", &state->sampler, "random\0sobol\0");
+  state->doTrace |= ImGui::InputInt("seed", &state->seed);
+  state->doTrace |= ImGui::Combo("mode", &state->traceMode,
+                                 "view factors\0gebhart\0");
+  if (state->traceMode == TRACE_GEBHART) {
+    state->materialsChanged |=
+        ImGui::SliderFloat("emissivity", &state->emissivity, 0.f, 1.f);
+    state->doTrace |=
+        ImGui::SliderInt("max bounces", &state->maxBounces, 1, 256);
+  }
 
   state->doTrace |= ImGui::Combo("select triangle:", &state->currTri, &State::itemGetter,
                state->triNames.data(), state->triNames.size());
 
   state->doTrace |= ImGui::Button("go");
-
+  ImGui::SameLine();
+  state->doTraceModel |= ImGui::Button("trace model");
+  ImGui::SameLine();
+  ImGui::Checkbox("record rays", &state->recordRays);
+  state->engineChanged |=
+      ImGui::Combo("engine", &state->engine, "vulkan\0cpu\0");
+  ImGui::Combo("cpu traversal", &state->cpuTraversal,
+               "single\0packet\0stream\0wide\0");
+  state->engineChanged |=
+      ImGui::Checkbox("cpu spatial splits", &state->cpuSpatialSplits);
+  ImGui::Checkbox("progressive", &state->progressive);
+  ImGui::SameLine();
+  ImGui::Text("launches: %d", state->accumulatedLaunches);
+  ImGui::Checkbox("adaptive", &state->adaptive);
+  ImGui::SameLine();
+  ImGui::Text("active rows: %d", state->activeRows);
+  ImGui::InputFloat("tolerance", &state->tolerance, 0.001f, 0.01f, "%.4f");
+  state->tolerance = std::max(state->tolerance, 0.f);
+
+  size_t nTris = state->triNames.size();
+  if (state->viewFactors.size() == nTris * nTris && nTris > 0) {
+    const float *row = state->viewFactors.data() + state->currTri * nTris;
+    float rowSum = 0.f;
+    for (size_t i = 0; i < nTris; ++i) {
+      rowSum += row[i];
+    }
+    ImGui::Text("view factor sum: %.4f", rowSum);
+    if (state->rowErrors.size() == nTris) {
+      ImGui::SameLine();
+      ImGui::Text("error: %.4f", state->rowErrors[state->currTri]);
+    }
+    if (ImPlot::BeginPlot("view factors")) {
+      ImPlot::PlotBars("F", row, static_cast<int>(nTris));
+      ImPlot::EndPlot();
+    }
+  }
 
   state->HAS_CHANGED = val_changed;
 
@@ -0,0 +1,187 @@
+#include "job.hpp"
+#include "json.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace oray {
+
+namespace {
+constexpr char const *SAMPLING_KEYS[] = {"rays",  "sampler",    "sampling",
+                                         "mode",  "maxBounces", "seed"};
+
+// rejects misspelled settings instead of silently tracing the defaults
+void checkKeys(Json const &json, std::initializer_list<char const *> allowed,
+               bool allowSampling, std::string const &where) {
+  for (auto const &key : json.keys()) {
+    bool known = false;
+    for (char const *name : allowed) {
+      known |= key == name;
+    }
+    for (char const *name : SAMPLING_KEYS) {
+      known |= allowSampling && key == name;
+    }
+    if (!known) {
+      throw std::runtime_error(where + ": unknown setting \"" + key + "\"!");
+    }
+  }
+}
+
+uint32_t readUint(Json const &json, std::string const &where) {
+  double value = json.asNumber();
+  if (value < 0. || value > UINT32_MAX || std::floor(value) != value) {
+    throw std::runtime_error(where + " must be a non-negative integer!");
+  }
+  return static_cast<uint32_t>(value);
+}
+
+// index of the value in names
+uint32_t readChoice(Json const &json,
+                    std::initializer_list<char const *> names,
+                    std::string const &where) {
+  std::string const &value = json.asString();
+  uint32_t index = 0;
+  for (char const *name : names) {
+    if (value == name) {
+      return index;
+    }
+    index++;
+  }
+  throw std::runtime_error(where + ": unknown value \"" + value + "\"!");
+}
+
+glm::vec3 readVec3(Json const &json, std::string const &where) {
+  auto const &elements = json.asArray();
+  if (elements.size() != 3) {
+    throw std::runtime_error(where + " must have three components!");
+  }
+  return glm::vec3(elements[0].asNumber(), elements[1].asNumber(),
+                   elements[2].asNumber());
+}
+
+void readSampling(Json const &json, TracingEngine::Sampling &sampling,
+                  std::string const &where) {
+  if (json.contains("rays")) {
+    sampling.nRays = readUint(json["rays"], where + " rays");
+  }
+  if (json.contains("sampler")) {
+    sampling.sampler = static_cast<Sampler>(
+        readChoice(json["sampler"], {"random", "sobol"}, where + " sampler"));
+  }
+  if (json.contains("sampling")) {
+    sampling.samplingMode = static_cast<SamplingMode>(readChoice(
+        json["sampling"], {"legacy", "cosine"}, where + " sampling"));
+  }
+  if (json.contains("mode")) {
+    sampling.traceMode = static_cast<TraceMode>(readChoice(
+        json["mode"], {"view factors", "gebhart"}, where + " mode"));
+  }
+  if (json.contains("maxBounces")) {
+    sampling.maxBounces = readUint(json["maxBounces"], where + " maxBounces");
+    if (sampling.maxBounces == 0) {
+      throw std::runtime_error(where + " maxBounces must be positive!");
+    }
+  }
+  if (json.contains("seed")) {
+    sampling.seed = readUint(json["seed"], where + " seed");
+  }
+}
+
+// the transform and emissivity settings of a scene object or an override
+void readObject(Json const &json, TransformComponent &transform,
+                float &emissivity, std::string const &where) {
+  if (json.contains("translation")) {
+    transform.translation =
+        readVec3(json["translation"], where + " translation");
+  }
+  if (json.contains("rotation")) {
+    transform.rotation = readVec3(json["rotation"], where + " rotation");
+  }
+  if (json.contains("scale")) {
+    transform.scale = readVec3(json["scale"], where + " scale");
+  }
+  if (json.contains("emissivity")) {
+    emissivity = static_cast<float>(json["emissivity"].asNumber());
+    if (emissivity < 0.f || emissivity > 1.f) {
+      throw std::runtime_error(where + " emissivity must be in [0, 1]!");
+    }
+  }
+}
+} // namespace
+
+Job Job::load(std::string const &path) {
+  Json json = Json::load(path);
+  checkKeys(json, {"engine", "objects", "defaults", "cases"}, false, path);
+
+  Job job{};
+  if (json.contains("engine")) {
+    job.engine = static_cast<EngineType>(
+        readChoice(json["engine"], {"vulkan", "cpu"}, path + " engine"));
+  }
+
+  for (auto const &jsonObject : json["objects"].asArray()) {
+    std::string where = "object " + std::to_string(job.objects.size());
+    checkKeys(jsonObject, {"mesh", "translation", "rotation", "scale",
+                           "emissivity"},
+              false, where);
+    Object object{};
+    object.mesh = jsonObject["mesh"].asString();
+    readObject(jsonObject, object.transform, object.emissivity, where);
+    job.objects.push_back(std::move(object));
+  }
+  if (job.objects.empty()) {
+    throw std::runtime_error(path + " has no objects!");
+  }
+
+  TracingEngine::Sampling defaults{};
+  // the bounce limit of the GUI
+  defaults.maxBounces = 64;
+  if (json.contains("defaults")) {
+    checkKeys(json["defaults"], {}, true, "defaults");
+    readSampling(json["defaults"], defaults, "defaults");
+  }
+
+  for (auto const &jsonCase : json["cases"].asArray()) {
+    Case c{};
+    c.name = "case " + std::to_string(job.cases.size());
+    if (jsonCase.contains("name")) {
+      c.name = jsonCase["name"].asString();
+    }
+    checkKeys(jsonCase, {"name", "output", "objects"}, true, c.name);
+    if (jsonCase.contains("output")) {
+      c.output = jsonCase["output"].asString();
+    }
+    c.sampling = defaults;
+    readSampling(jsonCase, c.sampling, c.name);
+    if (c.sampling.nRays == 0) {
+      throw std::runtime_error(c.name + " traces no rays!");
+    }
+
+    for (auto const &object : job.objects) {
+      c.transforms.push_back(object.transform);
+      c.emissivities.push_back(object.emissivity);
+    }
+    if (jsonCase.contains("objects")) {
+      auto const &overrides = jsonCase["objects"].asArray();
+      if (overrides.size() > job.objects.size()) {
+        throw std::runtime_error(c.name + " has more objects than the scene!");
+      }
+      for (size_t i = 0; i < overrides.size(); ++i) {
+        std::string where = c.name + " object " + std::to_string(i);
+        checkKeys(overrides[i], {"translation", "rotation", "scale",
+                                 "emissivity"},
+                  false, where);
+        readObject(overrides[i], c.transforms[i], c.emissivities[i], where);
+      }
+    }
+    job.cases.push_back(std::move(c));
+  }
+  if (job.cases.empty()) {
+    throw std::runtime_error(path + " has no cases!");
+  }
+  return job;
+}
+
+} // namespace oray
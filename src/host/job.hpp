@@ -0,0 +1,55 @@
+#pragma once
+
+#include "orayobject.hpp"
+#include "tracingengine.hpp"
+
+#include <string>
+#include <vector>
+
+namespace oray {
+
+// a study of several cases against one scene, read from a JSON job file
+//
+// {
+//   "engine": "vulkan",
+//   "objects": [{"mesh": "models/a.obj", "translation": [0, 0, 0],
+//                "rotation": [0, 0, 0], "scale": [1, 1, 1],
+//                "emissivity": 1},
+//               {"mesh": "models/b.obj"}],
+//   "defaults": {"rays": 1000, "sampler": "sobol"},
+//   "cases": [{"name": "open", "output": "open.csv", "seed": 1,
+//              "objects": [{}, {"rotation": [0, 0.5, 0]}]}]
+// }
+//
+// Case settings are "rays", "sampler" (random, sobol), "sampling" (legacy,
+// cosine), "mode" (view factors, gebhart), "maxBounces" (64 if not set) and
+// "seed". A case takes the ones it leaves out from "defaults", and the
+// transform and emissivity of every object from the scene unless its "objects"
+// entry of the same index overrides them. Paths are relative to the working
+// directory.
+struct Job {
+  struct Object {
+    std::string mesh;
+    TransformComponent transform;
+    float emissivity = 1.f;
+  };
+
+  struct Case {
+    std::string name;
+    // no view factors are written if empty
+    std::string output;
+    TracingEngine::Sampling sampling;
+    // one per scene object
+    std::vector<TransformComponent> transforms;
+    std::vector<float> emissivities;
+  };
+
+  EngineType engine = ENGINE_VULKAN;
+  std::vector<Object> objects;
+  std::vector<Case> cases;
+
+  // throws std::runtime_error naming the offending case or object
+  static Job load(std::string const &path);
+};
+
+} // namespace oray
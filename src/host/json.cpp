@@ -0,0 +1,313 @@
+#include "json.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace oray {
+
+// recursive descent over the text, RFC 8259 without surrogate pairs
+class Json::Parser {
+public:
+  explicit Parser(std::string const &text) : text{text} {};
+
+  Json document() {
+    Json value = parseValue(0);
+    skipSpace();
+    if (pos != text.size()) {
+      fail("trailing characters after the value");
+    }
+    return value;
+  }
+
+private:
+  // nesting limit, keeps malformed input from exhausting the stack
+  static constexpr int MAX_DEPTH = 64;
+
+  [[noreturn]] void fail(std::string const &what) const {
+    size_t line = 1 + std::count(text.begin(), text.begin() + pos, '\n');
+    throw std::runtime_error("json: " + what + " in line " +
+                             std::to_string(line) + "!");
+  }
+
+  void skipSpace() {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' ||
+                                 text[pos] == '\n' || text[pos] == '\r')) {
+      pos++;
+    }
+  }
+
+  // skips whitespace, then consumes c if it is next
+  bool consume(char c) {
+    skipSpace();
+    if (pos < text.size() && text[pos] == c) {
+      pos++;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(char c) {
+    if (!consume(c)) {
+      fail(std::string("expected '") + c + "'");
+    }
+  }
+
+  bool consumeWord(char const *word) {
+    size_t length = std::char_traits<char>::length(word);
+    if (text.compare(pos, length, word) == 0) {
+      pos += length;
+      return true;
+    }
+    return false;
+  }
+
+  Json parseValue(int depth) {
+    if (depth > MAX_DEPTH) {
+      fail("nesting too deep");
+    }
+    skipSpace();
+    if (pos == text.size()) {
+      fail("unexpected end of input");
+    }
+    Json value;
+    char c = text[pos];
+    if (c == '{') {
+      pos++;
+      value.type_ = JSON_OBJECT;
+      if (consume('}')) {
+        return value;
+      }
+      do {
+        skipSpace();
+        if (pos == text.size() || text[pos] != '"') {
+          fail("expected a member name");
+        }
+        std::string key = parseString();
+        if (value.contains(key)) {
+          fail("duplicate key \"" + key + "\"");
+        }
+        expect(':');
+        value.memberKeys.push_back(std::move(key));
+        value.elements.push_back(parseValue(depth + 1));
+      } while (consume(','));
+      expect('}');
+    } else if (c == '[') {
+      pos++;
+      value.type_ = JSON_ARRAY;
+      if (consume(']')) {
+        return value;
+      }
+      do {
+        value.elements.push_back(parseValue(depth + 1));
+      } while (consume(','));
+      expect(']');
+    } else if (c == '"') {
+      value.type_ = JSON_STRING;
+      value.string = parseString();
+    } else if (consumeWord("true")) {
+      value.type_ = JSON_BOOL;
+      value.boolean = true;
+    } else if (consumeWord("false")) {
+      value.type_ = JSON_BOOL;
+    } else if (consumeWord("null")) {
+      value.type_ = JSON_NULL;
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+      value.type_ = JSON_NUMBER;
+      value.number = parseNumber();
+    } else {
+      fail(std::string("unexpected character '") + c + "'");
+    }
+    return value;
+  }
+
+  double parseNumber() {
+    size_t start = pos;
+    auto digits = [this]() {
+      size_t first = pos;
+      while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+        pos++;
+      }
+      return pos - first;
+    };
+    consume('-');
+    if (digits() == 0) {
+      fail("expected a digit");
+    }
+    if (pos < text.size() && text[pos] == '.') {
+      pos++;
+      if (digits() == 0) {
+        fail("expected a digit after the decimal point");
+      }
+    }
+    if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+      pos++;
+      if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+        pos++;
+      }
+      if (digits() == 0) {
+        fail("expected a digit in the exponent");
+      }
+    }
+    return std::strtod(text.substr(start, pos - start).c_str(), nullptr);
+  }
+
+  std::string parseString() {
+    // the opening quote
+    pos++;
+    std::string result;
+    while (true) {
+      if (pos == text.size()) {
+        fail("unterminated string");
+      }
+      char c = text[pos++];
+      if (c == '"') {
+        return result;
+      }
+      if (static_cast<unsigned char>(c) < 0x20) {
+        fail("control character in string");
+      }
+      if (c != '\\') {
+        result += c;
+        continue;
+      }
+      if (pos == text.size()) {
+        fail("unterminated string");
+      }
+      char escape = text[pos++];
+      switch (escape) {
+      case '"':
+      case '\\':
+      case '/':
+        result += escape;
+        break;
+      case 'b':
+        result += '\b';
+        break;
+      case 'f':
+        result += '\f';
+        break;
+      case 'n':
+        result += '\n';
+        break;
+      case 'r':
+        result += '\r';
+        break;
+      case 't':
+        result += '\t';
+        break;
+      case 'u':
+        appendUtf8(result, parseCodePoint());
+        break;
+      default:
+        fail("invalid escape in string");
+      }
+    }
+  }
+
+  uint32_t parseCodePoint() {
+    if (pos + 4 > text.size()) {
+      fail("incomplete \\u escape");
+    }
+    uint32_t code = 0;
+    for (int i = 0; i < 4; ++i) {
+      char h = text[pos++];
+      code <<= 4;
+      if (h >= '0' && h <= '9') {
+        code |= h - '0';
+      } else if (h >= 'a' && h <= 'f') {
+        code |= h - 'a' + 10;
+      } else if (h >= 'A' && h <= 'F') {
+        code |= h - 'A' + 10;
+      } else {
+        fail("invalid \\u escape");
+      }
+    }
+    if (code >= 0xD800 && code <= 0xDFFF) {
+      fail("surrogate pairs are not supported");
+    }
+    return code;
+  }
+
+  static void appendUtf8(std::string &out, uint32_t code) {
+    if (code < 0x80) {
+      out += static_cast<char>(code);
+    } else if (code < 0x800) {
+      out += static_cast<char>(0xC0 | (code >> 6));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      out += static_cast<char>(0xE0 | (code >> 12));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+  }
+
+  std::string const &text;
+  size_t pos = 0;
+};
+
+Json Json::parse(std::string const &text) { return Parser{text}.document(); }
+
+Json Json::load(std::string const &path) {
+  std::ifstream file{path};
+  if (!file) {
+    throw std::runtime_error("failed to open " + path + "!");
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  try {
+    return parse(text.str());
+  } catch (std::runtime_error const &e) {
+    throw std::runtime_error(path + ": " + e.what());
+  }
+}
+
+void Json::expect(Type type, char const *name) const {
+  if (type_ != type) {
+    throw std::runtime_error(std::string("json: expected ") + name + "!");
+  }
+}
+
+bool Json::asBool() const {
+  expect(JSON_BOOL, "true or false");
+  return boolean;
+}
+
+double Json::asNumber() const {
+  expect(JSON_NUMBER, "a number");
+  return number;
+}
+
+std::string const &Json::asString() const {
+  expect(JSON_STRING, "a string");
+  return string;
+}
+
+std::vector<Json> const &Json::asArray() const {
+  expect(JSON_ARRAY, "an array");
+  return elements;
+}
+
+bool Json::contains(std::string const &key) const {
+  return type_ == JSON_OBJECT &&
+         std::find(memberKeys.begin(), memberKeys.end(), key) !=
+             memberKeys.end();
+}
+
+Json const &Json::operator[](std::string const &key) const {
+  expect(JSON_OBJECT, "an object");
+  auto it = std::find(memberKeys.begin(), memberKeys.end(), key);
+  if (it == memberKeys.end()) {
+    throw std::runtime_error("json: missing \"" + key + "\"!");
+  }
+  return elements[it - memberKeys.begin()];
+}
+
+std::vector<std::string> const &Json::keys() const {
+  expect(JSON_OBJECT, "an object");
+  return memberKeys;
+}
+
+} // namespace oray
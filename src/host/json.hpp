@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace oray {
+
+// read only JSON values, enough for job files. Numbers are doubles, objects
+// keep their members in file order and reject duplicate keys.
+class Json {
+public:
+  enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY,
+              JSON_OBJECT };
+
+  // throws std::runtime_error with the line of the first syntax error
+  static Json parse(std::string const &text);
+  static Json load(std::string const &path);
+
+  Type type() const { return type_; };
+  bool isObject() const { return type_ == JSON_OBJECT; };
+  bool isArray() const { return type_ == JSON_ARRAY; };
+
+  // the accessors throw if the value has another type
+  bool asBool() const;
+  double asNumber() const;
+  std::string const &asString() const;
+  std::vector<Json> const &asArray() const;
+
+  // object members, operator[] throws for missing keys
+  bool contains(std::string const &key) const;
+  Json const &operator[](std::string const &key) const;
+  std::vector<std::string> const &keys() const;
+
+private:
+  class Parser;
+
+  void expect(Type type, char const *name) const;
+
+  Type type_ = JSON_NULL;
+  bool boolean = false;
+  double number = 0.;
+  std::string string;
+  // array elements, or object values in the order of keys
+  std::vector<Json> elements;
+  std::vector<std::string> memberKeys;
+};
+
+} // namespace oray
@@ -15,8 +15,8 @@ struct TransformComponent {
   glm::vec3 scale{1.0f, 1.0f, 1.f};
   glm::vec3 rotation{};
 
-  glm::mat4 mat4();
-  glm::mat3 normalMatrix();
+  glm::mat4 mat4() const;
+  glm::mat3 normalMatrix() const;
 };
 
 class OrayObject {
@@ -36,6 +36,8 @@ public:
 
   std::shared_ptr<Geometry> geom{};
   glm::vec3 color{};
+  // gray diffuse material, the rest of the incident radiation is reflected
+  float emissivity = 1.f;
   TransformComponent transform;
 
 private:
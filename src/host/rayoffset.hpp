@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// ray origins and extents that scale with the scene, shared by raygen.rgen
+// and the CpuTracer. offsetRay is a port of src/shaders/rayoffset.glsl, keep
+// them in sync.
+namespace oray {
+
+// scene dependent parameters of the rays, the sceneScale and tMax push
+// constants of raygen.rgen
+struct RayExtent {
+  // largest coordinate magnitude in the scene, which bounds the rounding
+  // errors of hit points
+  float sceneScale;
+  // longer than any segment inside the scene bounds. tMin is 0, the origins
+  // are moved off their surfaces by offsetRay.
+  float tMax;
+};
+
+inline RayExtent rayExtent(glm::vec3 sceneMin, glm::vec3 sceneMax) {
+  glm::vec3 magnitude = glm::max(glm::abs(sceneMin), glm::abs(sceneMax));
+  RayExtent extent{};
+  extent.sceneScale =
+      std::max(std::max(magnitude.x, magnitude.y),
+               std::max(magnitude.z, std::numeric_limits<float>::min()));
+  // a ray can leave the bounds by the offset of its origin at most
+  extent.tMax = 1.01f * glm::length(sceneMax - sceneMin) + extent.sceneScale;
+  return extent;
+}
+
+namespace rayoffset {
+constexpr float ORIGIN = 1.f / 32.f;
+constexpr float FLOAT_SCALE = 1.f / 65536.f;
+constexpr float INT_SCALE = 256.f;
+
+// p moved by offset float steps away from zero, or toward zero for a
+// negative offset
+inline float addUlps(float p, int32_t offset) {
+  int32_t bits;
+  std::memcpy(&bits, &p, sizeof(bits));
+  bits += p < 0 ? -offset : offset;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+} // namespace rayoffset
+
+// Wächter and Binder, "A Fast and Robust Method for Avoiding
+// Self-Intersection", Ray Tracing Gems, 2019. See offsetRay in
+// src/shaders/rayoffset.glsl.
+inline glm::vec3 offsetRay(glm::vec3 p, glm::vec3 n, float sceneScale) {
+  using namespace rayoffset;
+  float origin = ORIGIN * sceneScale;
+  float floatScale = FLOAT_SCALE * sceneScale;
+  glm::vec3 result;
+  for (int k = 0; k < 3; ++k) {
+    result[k] = std::abs(p[k]) < origin
+                    ? p[k] + floatScale * n[k]
+                    : addUlps(p[k], static_cast<int32_t>(INT_SCALE * n[k]));
+  }
+  return result;
+}
+
+} // namespace oray
@@ -1,15 +1,25 @@
 #include "raytracing.hpp"
+#include "asbuilder.hpp"
 #include "buffer.hpp"
 #include "descriptors.hpp"
 #include "device.hpp"
 #include "glm/fwd.hpp"
 #include "pipeline.hpp"
+#include "rayoffset.hpp"
+#include "threadpool.hpp"
+#include "viewfactors.hpp"
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <iostream>
+#include <limits>
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
@@ -17,14 +27,31 @@
 
 namespace oray {
 
+namespace {
+// largest vertex displacement since the last full build, in units of the
+// triangle spacing, that refitBLAS still refits
+constexpr float MAX_REFIT_DISPLACEMENT = 0.5f;
+// rows of counters the host adds up in one task
+constexpr size_t COUNT_ROWS_PER_TASK = 16;
+
+uint32_t countTriangles(std::vector<OrayObject> const &orayObjects) {
+  uint32_t nTriangles = 0;
+  for (auto const &obj : orayObjects) {
+    nTriangles += obj.geom->getIndexCount() / 3;
+  }
+  return nTriangles;
+}
+} // namespace
+
 Raytracer::Raytracer(Device &device, std::vector<OrayObject> const &orayObjects,
                      std::shared_ptr<State> state)
-    : device(device), nTrinagles(static_cast<uint32_t>(
-                          orayObjects[0].geom->getIndexCount() / 3)),
-      state{state} {
+    : device(device), nTrinagles(countTriangles(orayObjects)), state{state} {
   assert(state && "state must have been set!");
-  buildBLAS(orayObjects);
-  buildTLAS();
+  if (orayObjects.empty()) {
+    throw std::runtime_error("nothing to trace, the scene has no objects!");
+  }
+  checkCountBufferSize();
+  buildAccelerationStructures(orayObjects);
   rtDescriptorSetLayout = createDescriptorSetLayout();
   rtDescriptorPool = createDescriptorPool();
   createShaderModules();
@@ -34,7 +61,22 @@ Raytracer::Raytracer(Device &device, std::vector<OrayObject> const &orayObjects,
 }
 
 Raytracer::~Raytracer() {
-  f.vkDestroyAccelerationStructureKHR(device.device(), blas, nullptr);
+  if (launchCmdBuf != VK_NULL_HANDLE) {
+    waitForLaunch();
+    vkDestroyFence(device.device(), launchFence, nullptr);
+    vkFreeCommandBuffers(device.device(), device.getComputeCommandPool(), 1,
+                         &launchCmdBuf);
+  }
+  if (triangleCmdBuf != VK_NULL_HANDLE) {
+    vkWaitForFences(device.device(), 1, &triangleFence, VK_TRUE, UINT64_MAX);
+    vkDestroyFence(device.device(), triangleFence, nullptr);
+    vkDestroySemaphore(device.device(), triangleSemaphore, nullptr);
+    vkFreeCommandBuffers(device.device(), device.getComputeCommandPool(), 1,
+                         &triangleCmdBuf);
+  }
+  for (auto blas : blases) {
+    f.vkDestroyAccelerationStructureKHR(device.device(), blas, nullptr);
+  }
   f.vkDestroyAccelerationStructureKHR(device.device(), tlas, nullptr);
   vkDestroyShaderModule(device.device(), rayGenShader, nullptr);
   vkDestroyShaderModule(device.device(), chShader, nullptr);
@@ -52,26 +94,68 @@ uint32_t Raytracer::alignUp(uint32_t val, uint32_t align) {
 
 
 std::vector<glm::vec4> Raytracer::returnBuffer(Buffer &buf) {
-  std::vector<glm::vec4> out(state->nRays);
+  std::vector<glm::vec4> out(buf.getInstanceCount());
   buf.map();
   buf.readFromBuffer(out.data());
   buf.unmap();
   return out;
 }
 
-void Raytracer::buildBLAS(std::vector<OrayObject> const &orayObjects) {
+void Raytracer::buildAccelerationStructures(
+    std::vector<OrayObject> const &orayObjects) {
+  auto start = std::chrono::high_resolution_clock::now();
+  // first submission: all BLAS in one batched build, followed by the queries
+  // of their compacted sizes
+  AsBuilder builder{device, f};
+  buildBLAS(orayObjects, builder);
+  VkCommandBuffer cmdBuf = device.beginComputeCommands();
+  builder.record(cmdBuf);
+  VkQueryPool queryPool = writeCompactionQueries(cmdBuf);
+  device.submitComputeCommands(cmdBuf);
+
+  // second submission: the compaction copies and the TLAS build, which needs
+  // the addresses of the compacted BLAS
+  cmdBuf = device.beginComputeCommands();
+  std::vector<RetiredBlas> retired = compactBLAS(cmdBuf, queryPool);
+  buildTLAS(orayObjects, cmdBuf);
+  device.submitComputeCommands(cmdBuf);
+  for (auto const &old : retired) {
+    f.vkDestroyAccelerationStructureKHR(device.device(), old.blas, nullptr);
+  }
+  asBuildTime = std::chrono::duration<float, std::milli>(
+                    std::chrono::high_resolution_clock::now() - start)
+                    .count();
+}
+
+void Raytracer::buildBLAS(std::vector<OrayObject> const &orayObjects,
+                          AsBuilder &builder) {
+  // object space BLAS, the placement happens in the TLAS instances. Objects
+  // sharing a Geometry share its BLAS.
+  objectBlas.clear();
+  for (auto const &obj : orayObjects) {
+    auto it = geometryBlas.find(obj.geom.get());
+    if (it == geometryBlas.end()) {
+      uint32_t blasIdx = static_cast<uint32_t>(blases.size());
+      it = geometryBlas.emplace(obj.geom.get(), blasIdx).first;
+      createBLAS(*obj.geom, builder);
+    }
+    objectBlas.push_back(it->second);
+  }
+  std::cout << "building " << blases.size() << " BLAS for "
+            << orayObjects.size() << " objects" << std::endl;
+}
+
+VkAccelerationStructureGeometryKHR Raytracer::blasGeometry(Geometry &geom) {
   VkAccelerationStructureGeometryTrianglesDataKHR triangles{};
   triangles.sType =
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
   triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-  triangles.vertexData.deviceAddress =
-      orayObjects.at(0).geom->getVertexBufferAddress();
+  triangles.vertexData.deviceAddress = geom.getVertexBufferAddress();
   triangles.vertexStride =
       static_cast<uint32_t>(sizeof(Geometry::TriangleVertex));
   triangles.indexType = VK_INDEX_TYPE_UINT32;
-  triangles.indexData.deviceAddress =
-      orayObjects.at(0).geom->getIndexBufferAddress();
-  triangles.maxVertex = orayObjects.at(0).geom->getIndexCount();
+  triangles.indexData.deviceAddress = geom.getIndexBufferAddress();
+  triangles.maxVertex = geom.getVertexCount() - 1;
   triangles.transformData = {0};
 
   VkAccelerationStructureGeometryKHR geometry{};
@@ -79,16 +163,29 @@ void Raytracer::buildBLAS(std::vector<OrayObject> const &orayObjects) {
   geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
   geometry.geometry.triangles = triangles;
   geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+  return geometry;
+}
+
+void Raytracer::createBLAS(Geometry &geom, AsBuilder &builder) {
+  VkAccelerationStructureGeometryKHR geometry = blasGeometry(geom);
 
   VkAccelerationStructureBuildRangeInfoKHR rangeInfo{};
   rangeInfo.firstVertex = 0;
-  rangeInfo.primitiveCount = orayObjects.at(0).geom->getIndexCount() / 3;
+  rangeInfo.primitiveCount = geom.getIndexCount() / 3;
   rangeInfo.primitiveOffset = 0;
   rangeInfo.transformOffset = 0;
 
   VkAccelerationStructureBuildGeometryInfoKHR buildInfo{};
   buildInfo.sType =
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+  // static geometry is built once and traced many times, dynamic geometry
+  // prefers short builds and refits
+  buildInfo.flags =
+      geom.isDynamic()
+          ? VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR |
+                VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR
+          : VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+                VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
   buildInfo.geometryCount = 1;
   buildInfo.pGeometries = &geometry;
   buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
@@ -101,79 +198,279 @@ void Raytracer::buildBLAS(std::vector<OrayObject> const &orayObjects) {
   f.vkGetAccelerationStructureBuildSizesKHR(
       device.device(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
       &buildInfo, &rangeInfo.primitiveCount, &sizeInfo);
-  blasBuffer = std::make_unique<Buffer>(
-      device, sizeInfo.accelerationStructureSize, 1,
+  std::unique_ptr<Buffer> blasBuffer;
+  VkAccelerationStructureKHR blas = createAccelerationStructure(
+      buildInfo.type, sizeInfo.accelerationStructureSize, blasBuffer);
+  blases.push_back(blas);
+  blasBuffers.push_back(std::move(blasBuffer));
+  blasFlags.push_back(buildInfo.flags);
+  buildInfo.dstAccelerationStructure = blas;
+  builder.add(buildInfo, geometry, rangeInfo.primitiveCount,
+              sizeInfo.buildScratchSize);
+
+  // dynamic geometry keeps its own scratch buffer for refits and rebuilds
+  if (geom.isDynamic()) {
+    blasScratchBuffers.push_back(std::make_unique<Buffer>(
+        device,
+        std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize), 1,
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        0));
+    blasReferences.push_back(refitReference(geom));
+  } else {
+    blasScratchBuffers.emplace_back();
+    blasReferences.emplace_back();
+  }
+}
+
+Raytracer::RefitReference Raytracer::refitReference(Geometry &geom) {
+  RefitReference reference{};
+  reference.positions = geom.getPositions();
+  glm::vec3 lower = reference.positions[0];
+  glm::vec3 upper = reference.positions[0];
+  for (auto const &position : reference.positions) {
+    lower = glm::min(lower, position);
+    upper = glm::max(upper, position);
+  }
+  // typical distance between neighbouring triangles of a surface mesh
+  float nTriangles = static_cast<float>(geom.getIndexCount() / 3);
+  reference.spacing = glm::length(upper - lower) / std::sqrt(nTriangles);
+  return reference;
+}
+
+void Raytracer::refitBLAS(Geometry &geom) {
+  auto it = geometryBlas.find(&geom);
+  if (it == geometryBlas.end()) {
+    throw std::runtime_error("geometry is not part of the traced scene!");
+  }
+  uint32_t idx = it->second;
+  if (!(blasFlags[idx] &
+        VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
+    throw std::runtime_error("only dynamic geometry can be refit!");
+  }
+  waitForLaunch();
+
+  // a refit keeps the tree topology of the last full build. Once vertices
+  // moved far compared to the triangle spacing the node bounds overlap a lot
+  // and tracing slows down, rebuild then.
+  RefitReference &reference = blasReferences[idx];
+  std::vector<glm::vec3> positions = geom.getPositions();
+  float maxDisplacement = 0.f;
+  for (size_t i = 0; i < positions.size(); ++i) {
+    maxDisplacement = std::max(
+        maxDisplacement, glm::length(positions[i] - reference.positions[i]));
+  }
+  bool rebuild = maxDisplacement > MAX_REFIT_DISPLACEMENT * reference.spacing;
+
+  VkAccelerationStructureGeometryKHR geometry = blasGeometry(geom);
+  VkAccelerationStructureBuildGeometryInfoKHR buildInfo{
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+  buildInfo.flags = blasFlags[idx];
+  buildInfo.geometryCount = 1;
+  buildInfo.pGeometries = &geometry;
+  buildInfo.mode = rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR
+                           : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+  buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+  buildInfo.srcAccelerationStructure = rebuild ? VK_NULL_HANDLE : blases[idx];
+  buildInfo.dstAccelerationStructure = blases[idx];
+  buildInfo.scratchData.deviceAddress = blasScratchBuffers[idx]->getAddress();
+
+  VkAccelerationStructureBuildRangeInfoKHR rangeInfo{};
+  rangeInfo.primitiveCount = geom.getIndexCount() / 3;
+  VkAccelerationStructureBuildRangeInfoKHR *pRangeInfo = &rangeInfo;
+
+  // the TLAS has to be refit as well whenever one of its BLAS changes
+  VkCommandBuffer cmdBuf = device.beginComputeCommands();
+  f.vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfo, &pRangeInfo);
+  memoryBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+  recordTLASBuild(cmdBuf, VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+  device.submitComputeCommands(cmdBuf);
+
+  if (rebuild) {
+    reference = refitReference(geom);
+  }
+  updateRayExtent();
+  resetTallies(accumulationSampling);
+}
+
+VkAccelerationStructureKHR
+Raytracer::createAccelerationStructure(VkAccelerationStructureTypeKHR type,
+                                       VkDeviceSize size,
+                                       std::unique_ptr<Buffer> &buffer) {
+  buffer = std::make_unique<Buffer>(
+      device, size, 1,
       VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       0);
 
-  VkAccelerationStructureCreateInfoKHR createInfo = {};
-  createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-  createInfo.type = buildInfo.type;
-  createInfo.size = sizeInfo.accelerationStructureSize;
-  createInfo.buffer = blasBuffer->getBuffer();
+  VkAccelerationStructureCreateInfoKHR createInfo{
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+  createInfo.type = type;
+  createInfo.size = size;
+  createInfo.buffer = buffer->getBuffer();
   createInfo.offset = 0;
+  VkAccelerationStructureKHR as;
   if (f.vkCreateAccelerationStructureKHR(device.device(), &createInfo, nullptr,
-                                         &blas) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create blas!");
+                                         &as) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create acceleration structure!");
   }
-  buildInfo.dstAccelerationStructure = blas;
+  return as;
+}
 
-  // scratch buffer
-  Buffer scratchBuffer = Buffer{device, sizeInfo.buildScratchSize, 1,
-                                VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                0};
-  buildInfo.scratchData.deviceAddress = scratchBuffer.getAddress();
+std::vector<uint32_t> Raytracer::compactableBLAS() {
+  std::vector<uint32_t> compactable;
+  for (uint32_t i = 0; i < blases.size(); ++i) {
+    if (blasFlags[i] &
+        VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) {
+      compactable.push_back(i);
+    }
+  }
+  return compactable;
+}
 
-  VkAccelerationStructureBuildRangeInfoKHR *pRangeInfo = &rangeInfo;
+VkQueryPool Raytracer::writeCompactionQueries(VkCommandBuffer cmdBuf) {
+  std::vector<VkAccelerationStructureKHR> sources;
+  for (uint32_t i : compactableBLAS()) {
+    sources.push_back(blases[i]);
+  }
+  if (sources.empty()) {
+    return VK_NULL_HANDLE;
+  }
+  uint32_t nCompact = static_cast<uint32_t>(sources.size());
+
+  VkQueryPoolCreateInfo queryInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+  queryInfo.queryType =
+      VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+  queryInfo.queryCount = nCompact;
+  VkQueryPool queryPool;
+  if (vkCreateQueryPool(device.device(), &queryInfo, nullptr, &queryPool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create compaction query pool!");
+  }
+  vkCmdResetQueryPool(cmdBuf, queryPool, 0, nCompact);
+  f.vkCmdWriteAccelerationStructuresPropertiesKHR(
+      cmdBuf, nCompact, sources.data(),
+      VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+  return queryPool;
+}
 
-  VkCommandBuffer cmdBuffer = device.beginSingleTimeCommands();
-  f.vkCmdBuildAccelerationStructuresKHR(cmdBuffer, 1, &buildInfo, &pRangeInfo);
-  device.endSingleTimeCommands(cmdBuffer);
-  vkDeviceWaitIdle(device.device());
-}
-
-void Raytracer::buildTLAS() {
-  VkAccelerationStructureDeviceAddressInfoKHR adressInfo{};
-  adressInfo.sType =
-      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-  adressInfo.accelerationStructure = blas;
-  VkDeviceAddress blasAdress = f.vkGetAccelerationStructureDeviceAddressKHR(
-      device.device(), &adressInfo);
-
-  instance.transform.matrix[0][0] = 1.f;
-  instance.transform.matrix[1][1] = 1.f;
-  instance.transform.matrix[2][2] = 1.f;
-  instance.instanceCustomIndex = 0;
-  instance.mask = 0xFF;
-  instance.instanceShaderBindingTableRecordOffset = 0;
-  instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-  instance.accelerationStructureReference = blasAdress;
-
-  Buffer stagingBuffer =
-      Buffer(device, sizeof(instance), 1, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-  stagingBuffer.map();
-  stagingBuffer.writeToBuffer(&instance);
-  instanceBuffer = std::make_unique<Buffer>(
-      device, sizeof(instance), 1,
-      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-          VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-  device.copyBuffer(stagingBuffer.getBuffer(), instanceBuffer->getBuffer(),
-                    sizeof(instance));
-  vkDeviceWaitIdle(device.device());
+std::vector<Raytracer::RetiredBlas>
+Raytracer::compactBLAS(VkCommandBuffer cmdBuf, VkQueryPool queryPool) {
+  if (queryPool == VK_NULL_HANDLE) {
+    return {};
+  }
+  std::vector<uint32_t> compactable = compactableBLAS();
+  uint32_t nCompact = static_cast<uint32_t>(compactable.size());
+
+  std::vector<VkDeviceSize> compactSizes(nCompact);
+  VkResult result = vkGetQueryPoolResults(
+      device.device(), queryPool, 0, nCompact,
+      compactSizes.size() * sizeof(VkDeviceSize), compactSizes.data(),
+      sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+  vkDestroyQueryPool(device.device(), queryPool, nullptr);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to query compacted blas sizes!");
+  }
 
-  VkAccelerationStructureBuildRangeInfoKHR rangeInfo;
-  rangeInfo.primitiveOffset = 0;
-  rangeInfo.primitiveCount = 1;
-  rangeInfo.firstVertex = 0;
-  rangeInfo.transformOffset = 0;
+  VkDeviceSize sizeBefore = 0;
+  VkDeviceSize sizeAfter = 0;
+  std::vector<RetiredBlas> retired;
+  for (uint32_t k = 0; k < nCompact; ++k) {
+    uint32_t i = compactable[k];
+    sizeBefore += blasBuffers[i]->getBufferSize();
+    sizeAfter += compactSizes[k];
+    std::unique_ptr<Buffer> compactBuffer;
+    VkCopyAccelerationStructureInfoKHR copyInfo{
+        VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR};
+    copyInfo.src = blases[i];
+    copyInfo.dst = createAccelerationStructure(
+        VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, compactSizes[k],
+        compactBuffer);
+    copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+    f.vkCmdCopyAccelerationStructureKHR(cmdBuf, &copyInfo);
+
+    // the originals are read by the copy, they live until it has executed
+    retired.push_back({blases[i], std::move(blasBuffers[i])});
+    blases[i] = copyInfo.dst;
+    blasBuffers[i] = std::move(compactBuffer);
+  }
+  memoryBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+  std::cout << "compacting " << nCompact << " BLAS from " << sizeBefore / 1024
+            << " KiB to " << sizeAfter / 1024 << " KiB" << std::endl;
+  return retired;
+}
+
+void Raytracer::writeInstances(std::vector<OrayObject> const &orayObjects) {
+  instances.clear();
+  instanceGeometries.clear();
+  instanceTransforms.clear();
+  uint32_t triangleOffset = 0;
+  for (size_t i = 0; i < orayObjects.size(); ++i) {
+    VkAccelerationStructureDeviceAddressInfoKHR adressInfo{};
+    adressInfo.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+    adressInfo.accelerationStructure = blases[objectBlas[i]];
+    VkDeviceAddress blasAdress = f.vkGetAccelerationStructureDeviceAddressKHR(
+        device.device(), &adressInfo);
+
+    // glm is column major, the instance transform is a row major 3x4 matrix
+    glm::mat4 transform = orayObjects[i].transform.mat4();
+    VkAccelerationStructureInstanceKHR instance{};
+    for (int row = 0; row < 3; ++row) {
+      for (int col = 0; col < 4; ++col) {
+        instance.transform.matrix[row][col] = transform[col][row];
+      }
+    }
+    // hit shaders add gl_PrimitiveID to get the global triangle index
+    instance.instanceCustomIndex = triangleOffset;
+    instance.mask = 0xFF;
+    instance.instanceShaderBindingTableRecordOffset = 0;
+    instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    instance.accelerationStructureReference = blasAdress;
+    instances.push_back(instance);
+    instanceGeometries.push_back(orayObjects[i].geom.get());
+    instanceTransforms.push_back(transform);
+    triangleOffset += orayObjects[i].geom->getIndexCount() / 3;
+  }
+  instanceStagingBuffer->writeToBuffer(instances.data());
+}
+
+void Raytracer::recordTLASBuild(VkCommandBuffer cmdBuf,
+                                VkBuildAccelerationStructureModeKHR mode) {
+  VkBufferCopy copyRegion{};
+  copyRegion.size = instanceBuffer->getBufferSize();
+  vkCmdCopyBuffer(cmdBuf, instanceStagingBuffer->getBuffer(),
+                  instanceBuffer->getBuffer(), 1, &copyRegion);
+  memoryBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+
+  VkAccelerationStructureGeometryKHR geometry = tlasGeometry();
+  VkAccelerationStructureBuildGeometryInfoKHR buildInfo =
+      tlasBuildInfo(&geometry);
+  buildInfo.mode = mode;
+  // updates refit the existing TLAS in place
+  buildInfo.srcAccelerationStructure =
+      mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR ? tlas
+                                                              : VK_NULL_HANDLE;
+  buildInfo.dstAccelerationStructure = tlas;
+  buildInfo.scratchData.deviceAddress = tlasScratchBuffer->getAddress();
+
+  VkAccelerationStructureBuildRangeInfoKHR rangeInfo{};
+  rangeInfo.primitiveCount = static_cast<uint32_t>(instances.size());
+  VkAccelerationStructureBuildRangeInfoKHR *pRangeInfo = &rangeInfo;
+  f.vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildInfo, &pRangeInfo);
+}
 
+VkAccelerationStructureGeometryKHR Raytracer::tlasGeometry() {
   VkAccelerationStructureGeometryInstancesDataKHR instancesVK{
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR};
   instancesVK.data.deviceAddress = instanceBuffer->getAddress();
@@ -183,56 +480,106 @@ void Raytracer::buildTLAS() {
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
   geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
   geometry.geometry.instances = instancesVK;
+  return geometry;
+}
 
+VkAccelerationStructureBuildGeometryInfoKHR
+Raytracer::tlasBuildInfo(VkAccelerationStructureGeometryKHR const *geometry) {
   VkAccelerationStructureBuildGeometryInfoKHR buildInfo{
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
-  buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR;
+  // instances move between articulation steps, updates are much cheaper than
+  // rebuilds
+  buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+                    VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
   buildInfo.geometryCount = 1;
-  buildInfo.pGeometries = &geometry;
+  buildInfo.pGeometries = geometry;
   buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
   buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
   buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
+  return buildInfo;
+}
 
+void Raytracer::buildTLAS(std::vector<OrayObject> const &orayObjects,
+                          VkCommandBuffer cmdBuf) {
+  uint32_t nInstances = static_cast<uint32_t>(orayObjects.size());
+  // stays mapped, every instance update goes through it
+  instanceStagingBuffer = std::make_unique<Buffer>(
+      device, sizeof(VkAccelerationStructureInstanceKHR), nInstances,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  instanceStagingBuffer->map();
+  instanceBuffer = std::make_unique<Buffer>(
+      device, sizeof(VkAccelerationStructureInstanceKHR), nInstances,
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  writeInstances(orayObjects);
+
+  VkAccelerationStructureGeometryKHR geometry = tlasGeometry();
+  VkAccelerationStructureBuildGeometryInfoKHR buildInfo =
+      tlasBuildInfo(&geometry);
   VkAccelerationStructureBuildSizesInfoKHR sizeInfo{
       VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
-
   f.vkGetAccelerationStructureBuildSizesKHR(
       device.device(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-      &buildInfo, &rangeInfo.primitiveCount, &sizeInfo);
+      &buildInfo, &nInstances, &sizeInfo);
 
-  tlasBuffer = std::make_unique<Buffer>(
-      device, sizeInfo.accelerationStructureSize, 1,
-      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
-          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+  tlas = createAccelerationStructure(
+      buildInfo.type, sizeInfo.accelerationStructureSize, tlasBuffer);
+
+  // kept for the lifetime of the TLAS, large enough for builds and updates
+  tlasScratchBuffer = std::make_unique<Buffer>(
+      device,
+      std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize), 1,
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       0);
 
-  VkAccelerationStructureCreateInfoKHR createInfo{
-      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
-  createInfo.type = buildInfo.type;
-  createInfo.size = sizeInfo.accelerationStructureSize;
-  createInfo.buffer = tlasBuffer->getBuffer();
-  createInfo.offset = 0;
-  if (f.vkCreateAccelerationStructureKHR(device.device(), &createInfo, nullptr,
-                                         &tlas) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create tlas!");
-  }
-
-  buildInfo.dstAccelerationStructure = tlas;
-
-  Buffer scratchBuffer = Buffer(device, sizeInfo.buildScratchSize, 1,
-                                VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                0);
-  buildInfo.scratchData.deviceAddress = scratchBuffer.getAddress();
+  recordTLASBuild(cmdBuf, VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+}
 
-  VkAccelerationStructureBuildRangeInfoKHR *pRangeInfo = &rangeInfo;
+void Raytracer::updateInstances(std::vector<OrayObject> const &orayObjects) {
+  if (orayObjects.size() != instances.size()) {
+    throw std::runtime_error(
+        "instance update cannot add or remove objects, rebuild the tlas!");
+  }
+  waitForLaunch();
+  writeInstances(orayObjects);
+  // the source triangles of the rays move with their objects
+  std::vector<MeshInfo> meshes = meshInfos(orayObjects);
+  meshBuffer->map();
+  meshBuffer->writeToBuffer(meshes.data());
+  meshBuffer->unmap();
+
+  VkCommandBuffer commandBuffer = device.beginComputeCommands();
+  recordTLASBuild(commandBuffer,
+                  VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+  device.submitComputeCommands(commandBuffer);
+  updateRayExtent();
+  resetTallies(accumulationSampling);
+}
 
-  VkCommandBuffer commandBuffer = device.beginSingleTimeCommands();
-  f.vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildInfo,
-                                        &pRangeInfo);
-  device.endSingleTimeCommands(commandBuffer);
-  vkDeviceWaitIdle(device.device());
+void Raytracer::updateRayExtent() {
+  glm::vec3 sceneMin{std::numeric_limits<float>::max()};
+  glm::vec3 sceneMax{std::numeric_limits<float>::lowest()};
+  for (size_t i = 0; i < instanceGeometries.size(); ++i) {
+    glm::vec3 lower = instanceGeometries[i]->getBoundsMin();
+    glm::vec3 upper = instanceGeometries[i]->getBoundsMax();
+    // the corners of the object space box bound the object in world space
+    for (int corner = 0; corner < 8; ++corner) {
+      glm::vec3 p{corner & 1 ? upper.x : lower.x,
+                  corner & 2 ? upper.y : lower.y,
+                  corner & 4 ? upper.z : lower.z};
+      glm::vec3 world = glm::vec3(instanceTransforms[i] * glm::vec4(p, 1.f));
+      sceneMin = glm::min(sceneMin, world);
+      sceneMax = glm::max(sceneMax, world);
+    }
+  }
+  RayExtent extent = rayExtent(sceneMin, sceneMax);
+  pushConstants.sceneScale = extent.sceneScale;
+  pushConstants.tMax = extent.tMax;
 }
 
 std::unique_ptr<DescriptorSetLayout> Raytracer::createDescriptorSetLayout() {
@@ -340,7 +687,8 @@ void Raytracer::createRtPipeline() {
   rtpci.pStages = pssci.data();
   rtpci.groupCount = static_cast<uint32_t>(rtsgci.size());
   rtpci.pGroups = rtsgci.data();
-  rtpci.maxPipelineRayRecursionDepth = 0;
+  // raygen traces every bounce itself, the hit shaders never trace
+  rtpci.maxPipelineRayRecursionDepth = 1;
   rtpci.layout = rtPipelineLayout;
 
   if (f.vkCreateRayTracingPipelinesKHR(device.device(), VK_NULL_HANDLE,
@@ -349,8 +697,6 @@ void Raytracer::createRtPipeline() {
     throw std::runtime_error("failed to createpipeline!");
   }
 
-  VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtPipelineProps{
-      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
   VkPhysicalDeviceProperties2 prop2{
       VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
   prop2.pNext = &rtPipelineProps;
@@ -431,51 +777,546 @@ void Raytracer::initPushConstants(std::vector<OrayObject> const &orayObjects) {
   VkDescriptorBufferInfo bufferInfo = outputBuffer->descriptorInfo();
   DescriptorWriter(*rtDescriptorSetLayout, *rtDescriptorPool)
       .writeandBuildTLAS(0, &tlas, rtDescriptorSet, &bufferInfo);
-  pushConstants.indexBuffer = orayObjects[0].geom->getIndexBufferAddress();
-  pushConstants.vertexBuffer = orayObjects[0].geom->getVertexBufferAddress();
+  createMeshBuffers(orayObjects);
+  pushConstants.meshBuffer = meshBuffer->getAddress();
+  pushConstants.tri2MeshBuffer = tri2MeshBuffer->getAddress();
+  pushConstants.nTriangles = nTrinagles;
+  // the single triangle trace does not accumulate hits
+  pushConstants.countBuffer = 0;
+  pushConstants.rowBuffer = 0;
+
+  createCountBuffers();
+  materialBuffer = std::make_unique<Buffer>(
+      device, sizeof(float), nTrinagles,
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  pushConstants.materialBuffer = materialBuffer->getAddress();
+  updateMaterials(orayObjects);
+  selectRayBuffers(0);
+  updateRayExtent();
+  resetAccumulation();
+}
 
-  resizeBuffers();
+std::vector<MeshInfo>
+Raytracer::meshInfos(std::vector<OrayObject> const &orayObjects) {
+  std::vector<MeshInfo> meshes;
+  uint32_t triangleOffset = 0;
+  for (auto const &obj : orayObjects) {
+    MeshInfo mesh{};
+    mesh.indexBuffer = obj.geom->getIndexBufferAddress();
+    mesh.vertexBuffer = obj.geom->getVertexBufferAddress();
+    mesh.transform = obj.transform.mat4();
+    mesh.triangleOffset = triangleOffset;
+    meshes.push_back(mesh);
+    triangleOffset += obj.geom->getIndexCount() / 3;
+  }
+  return meshes;
 }
 
-void Raytracer::resizeBuffers() {
+void Raytracer::createMeshBuffers(std::vector<OrayObject> const &orayObjects) {
+  std::vector<MeshInfo> meshes = meshInfos(orayObjects);
+  std::vector<uint32_t> tri2Mesh;
+  tri2Mesh.reserve(nTrinagles);
+  for (uint32_t i = 0; i < orayObjects.size(); ++i) {
+    tri2Mesh.insert(tri2Mesh.end(), orayObjects[i].geom->getIndexCount() / 3,
+                    i);
+  }
 
+  meshBuffer = std::make_unique<Buffer>(
+      device, sizeof(MeshInfo), static_cast<uint32_t>(meshes.size()),
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  meshBuffer->map();
+  meshBuffer->writeToBuffer(meshes.data());
+  meshBuffer->unmap();
 
-  oriBuffer =
-      std::make_unique<Buffer>(device, sizeof(glm::vec4), state->nBufferElements,
-                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-  dirBuffer =
-      std::make_unique<Buffer>(device, sizeof(glm::vec4), state->nBufferElements,
-                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  tri2MeshBuffer = std::make_unique<Buffer>(
+      device, sizeof(uint32_t), nTrinagles,
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  tri2MeshBuffer->map();
+  tri2MeshBuffer->writeToBuffer(tri2Mesh.data());
+  tri2MeshBuffer->unmap();
+}
 
+void Raytracer::checkCountBufferSize() {
+  checkTallySize(nTrinagles);
+  // one counter per pair of triangles, beyond 65535 triangles their number
+  // no longer fits 32 bits
+  VkDeviceSize countBytes =
+      sizeof(uint32_t) * static_cast<VkDeviceSize>(nTrinagles) * nTrinagles;
+  VkDeviceSize maxBytes = std::min(
+      device.maxBufferSize(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+      device.maxBufferSize(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT));
+  if (countBytes > maxBytes) {
+    throw std::runtime_error(
+        "the hit counters of " + std::to_string(nTrinagles) +
+        " triangles need " + std::to_string(countBytes >> 20) +
+        " MiB, the device allocates at most " +
+        std::to_string(maxBytes >> 20) + " MiB per buffer!");
+  }
+}
 
-  pushConstants.oriBuffer = oriBuffer->getAddress();
-  pushConstants.dirBuffer = dirBuffer->getAddress();
+void Raytracer::createCountBuffers() {
+  // the counters stay on the device, only the finished tallies are copied.
+  // A row of counters per instance keeps the size in 64 bits.
+  VkDeviceSize rowSize = sizeof(uint32_t) * nTrinagles;
+  countBuffer = std::make_unique<Buffer>(
+      device, rowSize, nTrinagles,
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  countReadbackBuffer = std::make_unique<Buffer>(
+      device, rowSize, nTrinagles, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  // rewritten by the host before every model launch, at most one row per
+  // triangle
+  rowBuffer = std::make_unique<Buffer>(
+      device, sizeof(RowEntry), nTrinagles,
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 }
 
-void Raytracer::traceTriangle(VkCommandBuffer cmdBuf) {
-  if (state->nBufferElements != state->nRays) {
-    state->nBufferElements = state->nRays;
-    resizeBuffers();
+void Raytracer::selectRayBuffers(size_t idx) {
+  rayBufferIdx = idx;
+  RayBuffers &rays = rayBuffers[idx];
+  uint32_t nRays = static_cast<uint32_t>(state->nBufferElements);
+  if (!rays.ori || rays.ori->getInstanceCount() != nRays) {
+    rays.ori = std::make_unique<Buffer>(
+        device, sizeof(glm::vec4), nRays,
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    rays.dir = std::make_unique<Buffer>(
+        device, sizeof(glm::vec4), nRays,
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    rays.hit = std::make_unique<Buffer>(
+        device, sizeof(uint32_t), nRays,
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
   }
-  pushConstants.triangleIndex = state->currTri;
+  pushConstants.oriBuffer = rays.ori->getAddress();
+  pushConstants.dirBuffer = rays.dir->getAddress();
+  pushConstants.hitBuffer = rays.hit->getAddress();
+}
 
+void Raytracer::memoryBarrier(VkCommandBuffer cmdBuf,
+                              VkPipelineStageFlags srcStage,
+                              VkAccessFlags srcAccess,
+                              VkPipelineStageFlags dstStage,
+                              VkAccessFlags dstAccess) {
+  VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  vkCmdPipelineBarrier(cmdBuf, srcStage, dstStage, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+}
 
+void Raytracer::bindRtPipeline(VkCommandBuffer cmdBuf) {
   vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rtPipeline);
   vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
                           rtPipelineLayout, 0, 1, &rtDescriptorSet, 0,
                           VK_NULL_HANDLE);
+}
+
+VkSemaphore Raytracer::traceTriangle() {
+  if (triangleSignalPending) {
+    throw std::runtime_error("triangle trace signaled before the last one "
+                             "was waited on!");
+  }
+  if (triangleCmdBuf == VK_NULL_HANDLE) {
+    VkCommandBufferAllocateInfo allocInfo{
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = device.getComputeCommandPool();
+    allocInfo.commandBufferCount = 1;
+    VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    VkSemaphoreCreateInfo semaphoreInfo{
+        VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    if (vkAllocateCommandBuffers(device.device(), &allocInfo,
+                                 &triangleCmdBuf) != VK_SUCCESS ||
+        vkCreateFence(device.device(), &fenceInfo, nullptr, &triangleFence) !=
+            VK_SUCCESS ||
+        vkCreateSemaphore(device.device(), &semaphoreInfo, nullptr,
+                          &triangleSemaphore) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create triangle trace objects!");
+    }
+  }
+  // the command buffer of the last trace
+  vkWaitForFences(device.device(), 1, &triangleFence, VK_TRUE, UINT64_MAX);
+  vkResetFences(device.device(), 1, &triangleFence);
+
+  // the set after the one of the last trace was last drawn at least
+  // MAX_FRAMES_IN_FLIGHT frames ago, its frame has finished by now
+  state->nBufferElements = state->nRays;
+  selectRayBuffers((rayBufferIdx + 1) % rayBuffers.size());
   pushConstants.triangleIndex = state->currTri;
+  pushConstants.samplingMode = static_cast<uint32_t>(state->samplingMode);
+  pushConstants.sampler = static_cast<uint32_t>(state->sampler);
+  pushConstants.launchIndex = 0;
+  pushConstants.traceMode = static_cast<uint32_t>(state->traceMode);
+  pushConstants.maxBounces =
+      static_cast<uint32_t>(std::max(state->maxBounces, 1));
+  pushConstants.seed = static_cast<uint32_t>(state->seed);
+
+  VkCommandBuffer cmdBuf = triangleCmdBuf;
+  vkResetCommandBuffer(cmdBuf, 0);
+  VkCommandBufferBeginInfo beginInfo{
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(cmdBuf, &beginInfo);
+  bindRtPipeline(cmdBuf);
   vkCmdPushConstants(cmdBuf, rtPipelineLayout, VK_SHADER_STAGE_RAYGEN_BIT_KHR,
                      0, static_cast<uint32_t>(sizeof(pushConstants)),
                      &pushConstants);
   f.vkCmdTraceRaysKHR(cmdBuf, &rgenRegion, &missRegion, &hitRegion, &callRegion,
                       state->nBufferElements, 1, 1);
+  vkEndCommandBuffer(cmdBuf);
+
+  VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &cmdBuf;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &triangleSemaphore;
+  if (vkQueueSubmit(device.computeQueue(), 1, &submitInfo, triangleFence) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to submit triangle trace!");
+  }
+  triangleSignalPending = true;
+  return triangleSemaphore;
+}
+
+void Raytracer::traceModel() {
+  if (state->nRays <= 0) {
+    return;
+  }
+  resetAccumulation();
+  launch(selectRows());
+  readViewFactors();
+}
+
+void Raytracer::beginModelTrace() {
+  if (state->nRays <= 0) {
+    return;
+  }
+  resetAccumulation();
+  submitLaunch(selectRows());
+}
+
+bool Raytracer::pollLaunch() {
+  if (!launchInFlight ||
+      vkGetFenceStatus(device.device(), launchFence) != VK_SUCCESS) {
+    return false;
+  }
+  finishLaunch();
+  readViewFactors();
+  return true;
+}
+
+void Raytracer::resetAccumulation() {
+  resetTallies(Sampling::fromState(*state));
+}
+
+void Raytracer::resetTallies(Sampling const &sampling) {
+  waitForLaunch();
+  accumulatedLaunches = 0;
+  state->accumulatedLaunches = 0;
+  rowLaunches.assign(nTrinagles, 0);
+  counts.assign(static_cast<size_t>(nTrinagles) * nTrinagles, 0);
+  launchedRows.clear();
+  state->rowErrors.clear();
+  state->activeRows = static_cast<int>(nTrinagles);
+  accumulationConstants = pushConstants;
+  accumulationConstants.oriBuffer = 0;
+  accumulationConstants.dirBuffer = 0;
+  accumulationConstants.hitBuffer = 0;
+  accumulationConstants.countBuffer = countBuffer->getAddress();
+  accumulationConstants.samplingMode = sampling.samplingMode;
+  accumulationConstants.sampler = sampling.sampler;
+  accumulationConstants.traceMode = sampling.traceMode;
+  accumulationConstants.maxBounces = sampling.maxBounces;
+  accumulationConstants.seed = sampling.seed;
+  accumulationSampling = sampling;
+}
+
+void Raytracer::launch(std::vector<uint32_t> const &triangles) {
+  waitForLaunch();
+  if (accumulationSampling.nRays == 0 || triangles.empty()) {
+    return;
+  }
+  VkCommandBuffer cmdBuf = device.beginComputeCommands();
+  recordModelTrace(cmdBuf, triangles);
+  device.submitComputeCommands(cmdBuf);
+  finishLaunch();
+}
+
+void Raytracer::updateMaterials(std::vector<OrayObject> const &orayObjects) {
+  waitForLaunch();
+  std::vector<float> emissivities;
+  emissivities.reserve(nTrinagles);
+  for (auto const &obj : orayObjects) {
+    emissivities.insert(emissivities.end(), obj.geom->getIndexCount() / 3,
+                        obj.emissivity);
+  }
+  materialBuffer->map();
+  materialBuffer->writeToBuffer(emissivities.data());
+  materialBuffer->unmap();
+  resetTallies(accumulationSampling);
+}
+
+bool Raytracer::refine() {
+  bool updated = pollLaunch();
+  if (launchInFlight) {
+    return false;
+  }
+
+  // settings changed, the old tallies would bias the estimate
+  if (accumulationSampling != Sampling::fromState(*state)) {
+    resetAccumulation();
+  }
+  if (accumulationSampling.nRays == 0) {
+    return updated;
+  }
+  std::vector<uint32_t> rows = selectRows();
+  if (rows.empty()) {
+    // every row is within the tolerance
+    return updated;
+  }
+  submitLaunch(rows);
+  return updated;
+}
+
+void Raytracer::submitLaunch(std::vector<uint32_t> const &rows) {
+  if (accumulationSampling.nRays == 0 || rows.empty()) {
+    return;
+  }
+  if (launchCmdBuf == VK_NULL_HANDLE) {
+    VkCommandBufferAllocateInfo allocInfo{
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = device.getComputeCommandPool();
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device.device(), &allocInfo, &launchCmdBuf) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate launch command buffer!");
+    }
+    VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    if (vkCreateFence(device.device(), &fenceInfo, nullptr, &launchFence) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create launch fence!");
+    }
+  }
+
+  vkResetFences(device.device(), 1, &launchFence);
+  vkResetCommandBuffer(launchCmdBuf, 0);
+  VkCommandBufferBeginInfo beginInfo{
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(launchCmdBuf, &beginInfo);
+  recordModelTrace(launchCmdBuf, rows);
+  vkEndCommandBuffer(launchCmdBuf);
+
+  VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &launchCmdBuf;
+  if (vkQueueSubmit(device.computeQueue(), 1, &submitInfo, launchFence) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to submit ray tracing launch!");
+  }
+  launchInFlight = true;
+}
+
+void Raytracer::waitForLaunch() {
+  if (launchInFlight) {
+    vkWaitForFences(device.device(), 1, &launchFence, VK_TRUE, UINT64_MAX);
+    finishLaunch();
+    readViewFactors();
+  }
+}
+
+void Raytracer::finishLaunch() {
+  launchInFlight = false;
+  accumulatedLaunches++;
+  state->accumulatedLaunches = static_cast<int>(accumulatedLaunches);
+  addLaunchCounts();
+}
+
+void Raytracer::addLaunchCounts() {
+  countReadbackBuffer->map();
+  auto const *launchCounts =
+      static_cast<uint32_t const *>(countReadbackBuffer->getMappedMemory());
+  ThreadPool::shared().parallelFor(
+      launchedRows.size(), COUNT_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          size_t offset = static_cast<size_t>(launchedRows[i]) * nTrinagles;
+          for (size_t target = 0; target < nTrinagles; ++target) {
+            counts[offset + target] += launchCounts[offset + target];
+          }
+        }
+      });
+  countReadbackBuffer->unmap();
+  launchedRows.clear();
+}
+
+std::vector<uint32_t> Raytracer::selectRows() {
+  std::vector<uint32_t> rows;
+  bool adaptive = state->adaptive &&
+                  state->rowErrors.size() == static_cast<size_t>(nTrinagles);
+  for (uint32_t tri = 0; tri < nTrinagles; ++tri) {
+    if (!adaptive || state->rowErrors[tri] > state->tolerance) {
+      rows.push_back(tri);
+    }
+  }
+  state->activeRows = static_cast<int>(rows.size());
+  return rows;
+}
+
+void Raytracer::recordModelTrace(VkCommandBuffer cmdBuf,
+                                 std::vector<uint32_t> const &rows) {
+  uint32_t nRays = accumulationSampling.nRays;
+  uint32_t nRows = static_cast<uint32_t>(rows.size());
+  RtPushConstants modelConstants = accumulationConstants;
+
+  // every row continues the sample sequence of its own triangle, the rows
+  // may have received different numbers of launches so far
+  std::vector<RowEntry> entries(nRows);
+  for (uint32_t i = 0; i < nRows; ++i) {
+    entries[i] = {rows[i], rowLaunches[rows[i]]};
+    rowLaunches[rows[i]]++;
+  }
+  launchedRows = rows;
+  rowBuffer->map();
+  rowBuffer->writeToBuffer(entries.data(), nRows * sizeof(RowEntry));
+  rowBuffer->unmap();
+  modelConstants.rowBuffer = rowBuffer->getAddress();
+
+  // per ray hit records are a debugging aid, they cost 4 bytes per ray and
+  // only hold the latest launch
+  if (state->recordRays) {
+    uint32_t nHits = nRays * nRows;
+    if (!modelHitBuffer || modelHitBuffer->getInstanceCount() != nHits) {
+      modelHitBuffer = std::make_unique<Buffer>(
+          device, sizeof(uint32_t), nHits,
+          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+  } else {
+    modelHitBuffer.reset();
+  }
+
+  // split into several launches, if rays x triangles exceeds the device limit
+  uint32_t rowsPerLaunch = std::max(
+      1u, rtPipelineProps.maxRayDispatchInvocationCount / nRays);
+
+  // only the launched rows are cleared and read back, in runs of consecutive
+  // rows. Late adaptive launches touch a small part of the n x n counters.
+  VkDeviceSize rowSize = countBuffer->getInstanceSize();
+  std::vector<VkBufferCopy> rowRegions;
+  for (uint32_t i = 0; i < nRows; ++i) {
+    if (i > 0 && rows[i] == rows[i - 1] + 1) {
+      rowRegions.back().size += rowSize;
+      continue;
+    }
+    VkBufferCopy region{};
+    region.srcOffset = rows[i] * rowSize;
+    region.dstOffset = region.srcOffset;
+    region.size = rowSize;
+    rowRegions.push_back(region);
+  }
+
+  // the 32 bit device counters start every launch at zero, a launch adds at
+  // most nRays to each of them. finishLaunch sums them up on the host in 64
+  // bits, where no number of launches makes them wrap.
+  for (auto const &region : rowRegions) {
+    vkCmdFillBuffer(cmdBuf, countBuffer->getBuffer(), region.srcOffset,
+                    region.size, 0);
+  }
+  memoryBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+  bindRtPipeline(cmdBuf);
+  for (uint32_t first = 0; first < nRows; first += rowsPerLaunch) {
+    uint32_t launchRows = std::min(rowsPerLaunch, nRows - first);
+    modelConstants.triangleIndex = first;
+    if (modelHitBuffer) {
+      modelConstants.hitBuffer =
+          modelHitBuffer->getAddress() +
+          static_cast<VkDeviceSize>(first) * nRays * sizeof(uint32_t);
+    }
+    vkCmdPushConstants(cmdBuf, rtPipelineLayout,
+                       VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0,
+                       static_cast<uint32_t>(sizeof(modelConstants)),
+                       &modelConstants);
+    f.vkCmdTraceRaysKHR(cmdBuf, &rgenRegion, &missRegion, &hitRegion,
+                        &callRegion, nRays, launchRows, 1);
+  }
+
+  memoryBarrier(cmdBuf, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_READ_BIT);
+  vkCmdCopyBuffer(cmdBuf, countBuffer->getBuffer(),
+                  countReadbackBuffer->getBuffer(),
+                  static_cast<uint32_t>(rowRegions.size()),
+                  rowRegions.data());
+  memoryBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                VK_ACCESS_HOST_READ_BIT);
+}
+
+TracingEngine::Tallies Raytracer::readTallies() {
+  waitForLaunch();
+  Tallies tallies{};
+  tallies.counts = counts;
+  tallies.rowRays = rowRays();
+  return tallies;
+}
+
+std::vector<uint64_t> Raytracer::rowRays() const {
+  std::vector<uint64_t> rays(nTrinagles);
+  for (uint32_t src = 0; src < nTrinagles; ++src) {
+    rays[src] =
+        static_cast<uint64_t>(accumulationSampling.nRays) * rowLaunches[src];
+  }
+  return rays;
+}
+
+void Raytracer::readViewFactors() {
+  // the tallies of the finished launch, without copying the counts
+  computeViewFactors(counts, rowRays(), state->viewFactors, state->rowErrors);
+}
+
+std::vector<uint32_t> Raytracer::readHitBuffer() {
+  if (!modelHitBuffer) {
+    return {};
+  }
+  std::vector<uint32_t> hits(modelHitBuffer->getInstanceCount());
+  modelHitBuffer->map();
+  modelHitBuffer->readFromBuffer(hits.data());
+  modelHitBuffer->unmap();
+  return hits;
 }
 
-} // namespace oray
\ No newline at end of file
+} // namespace oray
@@ -1,10 +1,13 @@
 #pragma once
+#include "asbuilder.hpp"
 #include "buffer.hpp"
 #include "descriptors.hpp"
 #include "device.hpp"
 #include "functions.hpp"
 #include "glm/glm.hpp"
 #include "orayobject.hpp"
+#include "swapchain.hpp"
+#include "tracingengine.hpp"
 
 #include "commonStructs.h"
 #include "state.hpp"
@@ -12,23 +15,74 @@
 #include <array>
 #include <cstdint>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 namespace oray {
 class State;
-class Raytracer {
+// the TracingEngine on a ray tracing GPU. Besides model traces it traces and
+// draws the rays of the selected triangle, and refines the model trace in the
+// background. Launches and acceleration structure builds run on the compute
+// queue of the Device, so frames keep drawing while a long trace runs.
+class Raytracer : public TracingEngine {
 public:
   Raytracer(Device &device, std::vector<OrayObject> const &orayObjects, std::shared_ptr<State> state);
-  ~Raytracer();
-  void traceTriangle(VkCommandBuffer cmdBuf);
+  ~Raytracer() override;
+  char const *name() const override { return "vulkan"; };
+  uint32_t triangleCount() const override { return nTrinagles; };
+  float buildTime() const override { return asBuildTime; };
+  // traces the rays of state->currTri into the next set of ray buffers on the
+  // compute queue. Returns the semaphore the submission signals, the frame
+  // that draws the rays must wait for it. The frames in flight keep drawing
+  // the sets of earlier calls, so there may be at most one call per frame.
+  // Throws while triangleSignalPending, the wait on the last signal has to be
+  // submitted first.
+  VkSemaphore traceTriangle();
+  // set by traceTriangle, cleared by the renderer once a frame waits on the
+  // semaphore
+  bool triangleSignalPending = false;
+  // traces state->nRays rays from every triangle in a single submission and
+  // stores the resulting view factor matrix in state->viewFactors
+  void traceModel() override;
+  // traceModel without blocking, pollLaunch reports when it is done
+  void beginModelTrace();
+  // true once a launch of beginModelTrace or refine finished, the view factors
+  // of the state then include it
+  bool pollLaunch();
+  bool isLaunching() const { return launchInFlight; };
+  // progressive mode: every finished call adds another launch of
+  // state->nRays rays per triangle to the tallies of the last traceModel or
+  // resetAccumulation. With state->adaptive only triangles whose row error is
+  // above state->tolerance get new rays. Does not block, returns true if a
+  // finished launch updated state->viewFactors.
+  bool refine();
+  // resetTallies with the sampling of the state
+  void resetAccumulation();
+  void resetTallies(Sampling const &sampling) override;
+  void launch(std::vector<uint32_t> const &triangles) override;
+  Tallies readTallies() override;
+  // moves the TLAS instances to the current transforms of the objects, which
+  // must be the ones the Raytracer was created with. Refits the TLAS instead
+  // of rebuilding it and restarts the accumulation.
+  void updateInstances(std::vector<OrayObject> const &orayObjects) override;
+  // refits the BLAS of dynamic geometry after Geometry::updatePositions, or
+  // rebuilds it when the vertices moved too far for a refit to trace well.
+  // Restarts the accumulation.
+  void refitBLAS(Geometry &geom);
+  // rewrites the per triangle emissivities and restarts the accumulation
+  void updateMaterials(std::vector<OrayObject> const &orayObjects) override;
   std::vector<glm::vec4> readOutputBuffer() {
     return returnBuffer(*outputBuffer);
   };
   std::vector<glm::vec4> readDirBuffer() {
-    return returnBuffer(*dirBuffer);
+    return returnBuffer(*rayBuffers[rayBufferIdx].dir);
   };
-  std::vector<glm::vec4> readOriBuffer() { return returnBuffer(*oriBuffer); };
-  Buffer &getOriBuffer() { return *oriBuffer; };
+  std::vector<glm::vec4> readOriBuffer() {
+    return returnBuffer(*rayBuffers[rayBufferIdx].ori);
+  };
+  // per ray hit triangles of the last traceModel, only with state->recordRays
+  std::vector<uint32_t> readHitBuffer();
+  Buffer &getOriBuffer() { return *rayBuffers[rayBufferIdx].ori; };
 
   RtPushConstants* pushConsts() {return &pushConstants;};
   std::shared_ptr<State> state;
@@ -38,23 +92,77 @@ private:
   Device &device;
   VulkanFunctions f = VulkanFunctions(device.device());
   // std::shared_ptr<const std::vector<OrayObject>> orayObjects;
-  std::unique_ptr<Buffer> blasBuffer;
-  VkAccelerationStructureKHR blas;
+  // one BLAS per distinct Geometry, objectBlas holds the BLAS of every
+  // object in the order of the TLAS instances
+  std::vector<std::unique_ptr<Buffer>> blasBuffers;
+  std::vector<VkAccelerationStructureKHR> blases;
+  // of the BLAS and the TLAS, compaction included
+  float asBuildTime = 0.f;
+  std::vector<uint32_t> objectBlas;
+  std::unordered_map<Geometry const *, uint32_t> geometryBlas;
+  std::vector<VkBuildAccelerationStructureFlagsKHR> blasFlags;
+
+  // vertex positions of dynamic geometry at the last full BLAS build
+  struct RefitReference {
+    std::vector<glm::vec3> positions;
+    float spacing = 0.f;
+  };
+  // both only set for dynamic geometry
+  std::vector<std::unique_ptr<Buffer>> blasScratchBuffers;
+  std::vector<RefitReference> blasReferences;
   std::unique_ptr<Buffer> tlasBuffer;
+  std::unique_ptr<Buffer> tlasScratchBuffer;
   VkAccelerationStructureKHR tlas;
   std::unique_ptr<Buffer> sbtBuffer;
 
   std::unique_ptr<Buffer> outputBuffer;
-  std::unique_ptr<Buffer> oriBuffer;
-  std::unique_ptr<Buffer> dirBuffer;
+  // rays of the triangle trace, one set per frame in flight. Every trace
+  // writes the next set in turn, the frames in flight may still draw the
+  // others.
+  struct RayBuffers {
+    std::unique_ptr<Buffer> ori;
+    std::unique_ptr<Buffer> dir;
+    std::unique_ptr<Buffer> hit;
+  };
+  std::array<RayBuffers, SwapChain::MAX_FRAMES_IN_FLIGHT> rayBuffers;
+  // the set of the last trace, which the frames draw
+  size_t rayBufferIdx = 0;
+  std::unique_ptr<Buffer> modelHitBuffer;
+  std::unique_ptr<Buffer> countBuffer;
+  std::unique_ptr<Buffer> countReadbackBuffer;
+  std::unique_ptr<Buffer> rowBuffer;
+  std::unique_ptr<Buffer> meshBuffer;
+  std::unique_ptr<Buffer> tri2MeshBuffer;
+  std::unique_ptr<Buffer> materialBuffer;
 
   std::unique_ptr<Buffer> instanceBuffer;
+  std::unique_ptr<Buffer> instanceStagingBuffer;
 
   std::unique_ptr<DescriptorSetLayout> rtDescriptorSetLayout;
   std::unique_ptr<DescriptorPool> rtDescriptorPool;
 
   RtPushConstants pushConstants;
 
+  // state of the accumulated whole model trace
+  RtPushConstants accumulationConstants;
+  Sampling accumulationSampling{};
+  uint32_t accumulatedLaunches = 0;
+  // launches of accumulationRays rays each source triangle received
+  std::vector<uint32_t> rowLaunches;
+  // hits of all launches since the last reset, n x n
+  std::vector<uint64_t> counts;
+  // rows of the launch in flight, their device counters are added to counts
+  // when it finishes
+  std::vector<uint32_t> launchedRows;
+  VkCommandBuffer launchCmdBuf = VK_NULL_HANDLE;
+  VkFence launchFence = VK_NULL_HANDLE;
+  bool launchInFlight = false;
+
+  // the triangle trace, signals triangleSemaphore for the renderer
+  VkCommandBuffer triangleCmdBuf = VK_NULL_HANDLE;
+  VkFence triangleFence = VK_NULL_HANDLE;
+  VkSemaphore triangleSemaphore = VK_NULL_HANDLE;
+
   VkShaderModule rayGenShader;
   VkShaderModule chShader;
   VkShaderModule missShader;
@@ -69,10 +177,41 @@ private:
   VkStridedDeviceAddressRegionKHR missRegion{};
   VkStridedDeviceAddressRegionKHR callRegion{};
 
+  VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtPipelineProps{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
+
   std::vector<uint8_t> handles{};
 
-  void buildBLAS(std::vector<OrayObject> const &orayObjects);
-  void buildTLAS();
+  // BLAS and TLAS of the scene in two submissions, the host reads the
+  // compacted BLAS sizes in between
+  void buildAccelerationStructures(std::vector<OrayObject> const &orayObjects);
+  void buildBLAS(std::vector<OrayObject> const &orayObjects,
+                 AsBuilder &builder);
+  VkAccelerationStructureGeometryKHR blasGeometry(Geometry &geom);
+  void createBLAS(Geometry &geom, AsBuilder &builder);
+  RefitReference refitReference(Geometry &geom);
+  std::vector<uint32_t> compactableBLAS();
+  VkQueryPool writeCompactionQueries(VkCommandBuffer cmdBuf);
+  // replaced BLAS, destroyed once the compaction copies have executed
+  struct RetiredBlas {
+    VkAccelerationStructureKHR blas;
+    std::unique_ptr<Buffer> buffer;
+  };
+  // replaces every BLAS built with ALLOW_COMPACTION by a compacted copy
+  std::vector<RetiredBlas> compactBLAS(VkCommandBuffer cmdBuf,
+                                       VkQueryPool queryPool);
+  void buildTLAS(std::vector<OrayObject> const &orayObjects,
+                 VkCommandBuffer cmdBuf);
+  void writeInstances(std::vector<OrayObject> const &orayObjects);
+  VkAccelerationStructureGeometryKHR tlasGeometry();
+  VkAccelerationStructureBuildGeometryInfoKHR
+  tlasBuildInfo(VkAccelerationStructureGeometryKHR const *geometry);
+  void recordTLASBuild(VkCommandBuffer cmdBuf,
+                       VkBuildAccelerationStructureModeKHR mode);
+  VkAccelerationStructureKHR
+  createAccelerationStructure(VkAccelerationStructureTypeKHR type,
+                              VkDeviceSize size,
+                              std::unique_ptr<Buffer> &buffer);
   std::unique_ptr<DescriptorSetLayout> createDescriptorSetLayout();
   std::unique_ptr<DescriptorPool> createDescriptorPool();
   void createShaderModules();
@@ -80,10 +219,38 @@ private:
   void createRtPipeline();
   void createShaderBindingTable();
   void initPushConstants(std::vector<OrayObject> const &orayObjects);
-  void resizeBuffers();
+  // makes set idx the one the push constants point to, (re)creates it for
+  // state->nBufferElements rays if needed
+  void selectRayBuffers(size_t idx);
+  std::vector<MeshInfo> meshInfos(std::vector<OrayObject> const &orayObjects);
+  void createMeshBuffers(std::vector<OrayObject> const &orayObjects);
+  // throws if the n x n hit counters do not fit a buffer of the device
+  void checkCountBufferSize();
+  void createCountBuffers();
+  void bindRtPipeline(VkCommandBuffer cmdBuf);
+  void memoryBarrier(VkCommandBuffer cmdBuf, VkPipelineStageFlags srcStage,
+                     VkAccessFlags srcAccess, VkPipelineStageFlags dstStage,
+                     VkAccessFlags dstAccess);
+  void recordModelTrace(VkCommandBuffer cmdBuf,
+                        std::vector<uint32_t> const &rows);
+  std::vector<uint32_t> selectRows();
+  // records the rows into launchCmdBuf and submits it without waiting
+  void submitLaunch(std::vector<uint32_t> const &rows);
+  void waitForLaunch();
+  void finishLaunch();
+  // adds the count readback of the launched rows to counts
+  void addLaunchCounts();
+  std::vector<uint64_t> rowRays() const;
+  void readViewFactors();
   VkShaderModule createShaderModule(const std::string &filepath);
 
-  VkAccelerationStructureInstanceKHR instance{};
+  std::vector<VkAccelerationStructureInstanceKHR> instances{};
+  // geometry and transform of every instance, for the scene bounds
+  std::vector<Geometry const *> instanceGeometries{};
+  std::vector<glm::mat4> instanceTransforms{};
+  // sets the sceneScale and tMax push constants from the bounds of the
+  // instances, after they or their geometry moved
+  void updateRayExtent();
   uint32_t alignUp(uint32_t val, uint32_t align);
 
   std::vector<glm::vec4> returnBuffer(Buffer &buffer);
@@ -108,7 +108,14 @@ void Renderer::endFrame() {
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
     throw std::runtime_error("failed to record command buffer!");
   }
-  auto result = swapchain->submitCommandBuffers(&commandBuffer, &currentImgIdx);
+  auto result = swapchain->submitCommandBuffers(&commandBuffer, &currentImgIdx,
+                                                waitSemaphores, waitStages);
+  waitSemaphores.clear();
+  waitStages.clear();
+  for (bool *pending : waitPending) {
+    *pending = false;
+  }
+  waitPending.clear();
   if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
       window.wasWindowResized()) {
     window.resetWindowResizedFlag();
@@ -35,6 +35,18 @@ public:
 
   VkCommandBuffer beginFrame();
   void endFrame();
+  // the next submitted frame waits for semaphore before stage, e.g. for
+  // results of the compute queue it draws. A binary semaphore must not be
+  // signaled again before that wait is submitted, signalPending is cleared
+  // once it is.
+  void waitForSemaphore(VkSemaphore semaphore, VkPipelineStageFlags stage,
+                        bool *signalPending = nullptr) {
+    waitSemaphores.push_back(semaphore);
+    waitStages.push_back(stage);
+    if (signalPending) {
+      waitPending.push_back(signalPending);
+    }
+  }
   void beginSwapchainRenderPass(VkCommandBuffer commandBuffer);
   void endSwapchainRenderPass(VkCommandBuffer commandBuffer);
   void renderGui(VkCommandBuffer commandBuffer) {
@@ -58,6 +70,9 @@ private:
   std::unique_ptr<SwapChain> swapchain;
   std::unique_ptr<Gui> gui;
   std::vector<VkCommandBuffer> commandBuffers;
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<VkPipelineStageFlags> waitStages;
+  std::vector<bool *> waitPending;
 
   uint32_t currentImgIdx;
   int currentFrameIdx{0};
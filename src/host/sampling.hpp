@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace oray {
+namespace sampling {
+// host versions of src/shaders/random.glsl, src/shaders/sobol.glsl and the
+// direction sampling of raygen.rgen. They must produce the same numbers as
+// the shaders, so the CPU tracer draws the same rays as the GPU.
+
+inline uint32_t tea(uint32_t val0, uint32_t val1) {
+  uint32_t v0 = val0;
+  uint32_t v1 = val1;
+  uint32_t s0 = 0;
+  for (uint32_t n = 0; n < 16; n++) {
+    s0 += 0x9e3779b9;
+    v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+    v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+  }
+  return v0;
+}
+
+constexpr uint32_t PHILOX_M0 = 0xD2511F53u;
+constexpr uint32_t PHILOX_M1 = 0xCD9E8D57u;
+constexpr uint32_t PHILOX_W0 = 0x9E3779B9u;
+constexpr uint32_t PHILOX_W1 = 0xBB67AE85u;
+
+// Philox4x32-10, see philox in src/shaders/random.glsl
+inline glm::uvec4 philox(glm::uvec4 counter, glm::uvec2 key) {
+  for (int i = 0; i < 10; i++) {
+    uint64_t p0 = static_cast<uint64_t>(PHILOX_M0) * counter.x;
+    uint64_t p1 = static_cast<uint64_t>(PHILOX_M1) * counter.z;
+    uint32_t hi0 = static_cast<uint32_t>(p0 >> 32);
+    uint32_t hi1 = static_cast<uint32_t>(p1 >> 32);
+    counter = glm::uvec4{hi1 ^ counter.y ^ key.x, static_cast<uint32_t>(p1),
+                         hi0 ^ counter.w ^ key.y, static_cast<uint32_t>(p0)};
+    key.x += PHILOX_W0;
+    key.y += PHILOX_W1;
+  }
+  return counter;
+}
+
+inline glm::vec4 rayRandom(uint32_t seed, uint32_t tri, uint64_t sampleIdx,
+                           uint32_t block) {
+  glm::uvec4 counter{static_cast<uint32_t>(sampleIdx),
+                     static_cast<uint32_t>(sampleIdx >> 32), block, 0u};
+  glm::uvec4 bits = philox(counter, glm::uvec2{seed, tri});
+  return glm::vec4(bits >> 8u) / static_cast<float>(0x01000000);
+}
+
+constexpr uint32_t SOBOL_DIRECTIONS[4][32] = {
+    {0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u,
+     0x04000000u, 0x02000000u, 0x01000000u, 0x00800000u, 0x00400000u,
+     0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u,
+     0x00010000u, 0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u,
+     0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u, 0x00000080u,
+     0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u,
+     0x00000002u, 0x00000001u},
+    {0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u, 0x88000000u,
+     0xcc000000u, 0xaa000000u, 0xff000000u, 0x80800000u, 0xc0c00000u,
+     0xa0a00000u, 0xf0f00000u, 0x88880000u, 0xcccc0000u, 0xaaaa0000u,
+     0xffff0000u, 0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u,
+     0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u, 0x80808080u,
+     0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u, 0x88888888u, 0xccccccccu,
+     0xaaaaaaaau, 0xffffffffu},
+    {0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u, 0xe8000000u,
+     0x5c000000u, 0x8e000000u, 0xc5000000u, 0x68800000u, 0x9cc00000u,
+     0xee600000u, 0x55900000u, 0x80680000u, 0xc09c0000u, 0x60ee0000u,
+     0x90550000u, 0xe8808000u, 0x5cc0c000u, 0x8e606000u, 0xc5909000u,
+     0x6868e800u, 0x9c9c5c00u, 0xeeee8e00u, 0x5555c500u, 0x8000e880u,
+     0xc0005cc0u, 0x60008e60u, 0x9000c590u, 0xe8006868u, 0x5c009c9cu,
+     0x8e00eeeeu, 0xc5005555u},
+    {0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u, 0xf8000000u,
+     0x74000000u, 0xa2000000u, 0x93000000u, 0xd8800000u, 0x25400000u,
+     0x59e00000u, 0xe6d00000u, 0x78080000u, 0xb40c0000u, 0x82020000u,
+     0xc3050000u, 0x208f8000u, 0x51474000u, 0xfbea2000u, 0x75d93000u,
+     0xa0858800u, 0x914e5400u, 0xdbe79e00u, 0x25db6d00u, 0x58800080u,
+     0xe54000c0u, 0x79e00020u, 0xb6d00050u, 0x800800f8u, 0xc00c0074u,
+     0x200200a2u, 0x50050093u}};
+
+inline uint32_t sobol(uint32_t index, uint32_t dim) {
+  uint32_t x = 0;
+  for (uint32_t bit = 0; index != 0; ++bit, index >>= 1) {
+    if ((index & 1) != 0) {
+      x ^= SOBOL_DIRECTIONS[dim][bit];
+    }
+  }
+  return x;
+}
+
+// GLSL's bitfieldReverse
+inline uint32_t reverseBits(uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+  x = reverseBits(x);
+  x = laineKarrasPermutation(x, seed);
+  return reverseBits(x);
+}
+
+inline uint32_t hashCombine(uint32_t seed, uint32_t v) {
+  return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+inline glm::vec4 sobol4(uint32_t index, uint32_t seed) {
+  index = nestedUniformScramble(index, seed);
+  glm::uvec4 x{
+      nestedUniformScramble(sobol(index, 0u), hashCombine(seed, 0u)),
+      nestedUniformScramble(sobol(index, 1u), hashCombine(seed, 1u)),
+      nestedUniformScramble(sobol(index, 2u), hashCombine(seed, 2u)),
+      nestedUniformScramble(sobol(index, 3u), hashCombine(seed, 3u))};
+  return glm::vec4(x >> 8u) / static_cast<float>(0x01000000);
+}
+
+inline glm::vec3 sampleCosine(float u1, float u2, glm::vec3 tangent,
+                              glm::vec3 bitangent, glm::vec3 normal) {
+  float r = std::sqrt(u1);
+  float teta = u2 * glm::radians(360.f);
+  return r * std::cos(teta) * tangent + r * std::sin(teta) * bitangent +
+         std::sqrt(std::max(0.f, 1.f - u1)) * normal;
+}
+
+inline glm::vec3 sampleLegacy(float u1, float u2, glm::vec3 tangent,
+                              glm::vec3 bitangent, glm::vec3 normal) {
+  float phi = std::acos(2 * u1 - 1);
+  float teta = u2 * glm::radians(360.f);
+  return std::cos(phi) *
+             (std::sin(teta) * bitangent + std::cos(teta) * tangent) +
+         std::sin(phi) * normal;
+}
+
+} // namespace sampling
+} // namespace oray
@@ -3,8 +3,11 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include "bvh.hpp"
+#include "commonStructs.h"
 #include "orayobject.hpp"
 #include "raytracing.hpp"
+#include "tracingengine.hpp"
 #include "vector"
 
 namespace oray {
@@ -21,26 +24,62 @@ struct State {
     return true;
   };
 
-  void setTriangleNames(OrayObject *obj) {
-        std::vector<std::string> names;
-    for (int i = 0; i < obj->geom->getIndexCount() / 3; ++i) {
-      names.push_back("Triangle" + std::to_string(i));
+  // triangles are numbered over all objects, in the order of the vector
+  void setTriangleNames(std::vector<OrayObject> const &objs) {
+    std::vector<std::string> names;
+    for (size_t o = 0; o < objs.size(); ++o) {
+      for (uint32_t i = 0; i < objs[o].geom->getIndexCount() / 3; ++i) {
+        names.push_back("Object" + std::to_string(o) + " Triangle" +
+                        std::to_string(i));
+      }
     }
     triNames = names;
   }
   State() {};
-  State(OrayObject *obj) {
-    setTriangleNames(obj);
+  State(std::vector<OrayObject> const &objs) {
+    setTriangleNames(objs);
   };
 
 
   float lineWidth = 1.0f;
   bool doTrace = true;
+  bool doTraceModel = false;
+  // EngineType of the model traces, applied when engineChanged is set
+  int engine = ENGINE_VULKAN;
+  bool engineChanged = false;
+  int cpuTraversal = TRAVERSAL_WIDE;
+  // BvhOptions::spatialSplits, applies when the CpuTracer is created, which
+  // engineChanged does
+  bool cpuSpatialSplits = false;
+  // keep the hit triangle of every ray of traceModel, for debugging only
+  bool recordRays = false;
+  int samplingMode = SAMPLING_COSINE;
+  int sampler = SAMPLER_SOBOL;
+  // run seed of the random numbers and of the Sobol scrambling
+  int seed = 0;
+  int traceMode = TRACE_VIEW_FACTORS;
+  // applied to every object when materialsChanged is set
+  float emissivity = 1.f;
+  bool materialsChanged = false;
+  int maxBounces = 64;
+  // keep adding launches to the model trace in the background
+  bool progressive = false;
+  int accumulatedLaunches = 0;
+  // progressive launches only trace triangles whose row error is above the
+  // tolerance
+  bool adaptive = false;
+  float tolerance = 0.01f;
+  int activeRows = 0;
+  // 95% confidence half width of every view factor row
+  std::vector<float> rowErrors{};
   bool HAS_CHANGED = true;
   int currTri = 0;
   int nRays = 50;
   int nBufferElements = nRays;
   std::vector<std::string> triNames{};
+  // row major, viewFactors[src * triNames.size() + target]. Holds Gebhart
+  // factors with TRACE_GEBHART.
+  std::vector<float> viewFactors{};
 };
 }
 
@@ -81,8 +81,10 @@ VkResult SwapChain::acquireNextImage(uint32_t *imageIndex) {
   return result;
 }
 
-VkResult SwapChain::submitCommandBuffers(const VkCommandBuffer *buffers,
-                                         uint32_t *imageIndex) {
+VkResult SwapChain::submitCommandBuffers(
+    const VkCommandBuffer *buffers, uint32_t *imageIndex,
+    std::vector<VkSemaphore> const &waitSemaphores,
+    std::vector<VkPipelineStageFlags> const &waitStages) {
   if (imagesInFlight[*imageIndex] != VK_NULL_HANDLE) {
     vkWaitForFences(device.device(), 1, &imagesInFlight[*imageIndex], VK_TRUE,
                     UINT64_MAX);
@@ -92,12 +94,16 @@ VkResult SwapChain::submitCommandBuffers(const VkCommandBuffer *buffers,
   VkSubmitInfo submitInfo = {};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-  VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-  VkPipelineStageFlags waitStages[] = {
+  std::vector<VkSemaphore> semaphores = {
+      imageAvailableSemaphores[currentFrame]};
+  std::vector<VkPipelineStageFlags> stages = {
       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
+  semaphores.insert(semaphores.end(), waitSemaphores.begin(),
+                    waitSemaphores.end());
+  stages.insert(stages.end(), waitStages.begin(), waitStages.end());
+  submitInfo.waitSemaphoreCount = static_cast<uint32_t>(semaphores.size());
+  submitInfo.pWaitSemaphores = semaphores.data();
+  submitInfo.pWaitDstStageMask = stages.data();
 
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = buffers;
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "device.hpp"
 
 // vulkan headers
@@ -45,8 +47,12 @@ public:
   VkFormat findDepthFormat();
 
   VkResult acquireNextImage(uint32_t *imageIndex);
-  VkResult submitCommandBuffers(const VkCommandBuffer *buffers,
-                                uint32_t *imageIndex);
+  // the submission also waits for waitSemaphores, each at the stage of the
+  // same index in waitStages
+  VkResult submitCommandBuffers(
+      const VkCommandBuffer *buffers, uint32_t *imageIndex,
+      std::vector<VkSemaphore> const &waitSemaphores = {},
+      std::vector<VkPipelineStageFlags> const &waitStages = {});
   bool compareSwapFormats(const SwapChain &swapchain) const {
     return swapchain.swapChainDepthFormat == swapChainDepthFormat &&
            swapchain.swapChainImageFormat == swapChainImageFormat;
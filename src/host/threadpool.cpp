@@ -0,0 +1,154 @@
+#include "threadpool.hpp"
+
+namespace oray {
+
+namespace {
+// the pool the current thread works for, and its deque there
+thread_local ThreadPool const *currentPool = nullptr;
+thread_local size_t currentQueue = 0;
+} // namespace
+
+ThreadPool::ThreadPool(unsigned nThreads) {
+  if (nThreads == 0) {
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (unsigned i = 0; i <= nThreads; ++i) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (unsigned i = 0; i < nThreads; ++i) {
+    workers.emplace_back([this, i]() { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock{sleepMutex};
+    stopping = true;
+  }
+  wakeUp.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool{};
+  return pool;
+}
+
+size_t ThreadPool::ownQueue() const {
+  return currentPool == this ? currentQueue : workers.size();
+}
+
+void ThreadPool::push(Task task) {
+  // counted first, so nQueued never drops below the tasks in the deques
+  nQueued++;
+  Queue &queue = *queues[ownQueue()];
+  {
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    queue.tasks.push_back(std::move(task));
+  }
+  // a worker checks nQueued under the lock before it sleeps
+  { std::lock_guard<std::mutex> lock{sleepMutex}; }
+  wakeUp.notify_one();
+}
+
+bool ThreadPool::pop(size_t self, Task &task) {
+  size_t nQueues = queues.size();
+  {
+    Queue &own = *queues[self];
+    std::lock_guard<std::mutex> lock{own.mutex};
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  // steal the oldest task, which is the largest range of a forRange
+  for (size_t k = 1; k < nQueues; ++k) {
+    Queue &victim = *queues[(self + k) % nQueues];
+    std::lock_guard<std::mutex> lock{victim.mutex};
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::runOne(size_t self) {
+  Task task;
+  if (nQueued == 0 || !pop(self, task)) {
+    return false;
+  }
+  nQueued--;
+  std::exception_ptr error;
+  if (!task.group->cancelled()) {
+    try {
+      task.function();
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+  task.group->finish(error);
+  return true;
+}
+
+void ThreadPool::work(size_t self) {
+  currentPool = this;
+  currentQueue = self;
+  while (true) {
+    if (runOne(self)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock{sleepMutex};
+    wakeUp.wait(lock, [this]() { return stopping || nQueued > 0; });
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+ThreadPool::TaskGroup::~TaskGroup() {
+  // the tasks refer to the group
+  cancel();
+  while (pending > 0) {
+    if (!pool.runOne(pool.ownQueue())) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ThreadPool::TaskGroup::run(std::function<void()> task) {
+  pending++;
+  pool.push({std::move(task), this});
+}
+
+void ThreadPool::TaskGroup::wait() {
+  size_t self = pool.ownQueue();
+  while (pending > 0) {
+    if (!pool.runOne(self)) {
+      std::this_thread::yield();
+    }
+  }
+  std::lock_guard<std::mutex> lock{errorMutex};
+  if (error) {
+    std::exception_ptr first = error;
+    error = nullptr;
+    std::rethrow_exception(first);
+  }
+}
+
+void ThreadPool::TaskGroup::finish(std::exception_ptr taskError) {
+  if (taskError) {
+    cancel();
+    std::lock_guard<std::mutex> lock{errorMutex};
+    if (!error) {
+      error = taskError;
+    }
+  }
+  pending--;
+}
+
+} // namespace oray
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace oray {
+
+// work stealing pool for host side work. Every worker owns a deque, it runs
+// the newest of its own tasks first and steals the oldest ones of the others
+// when it runs dry. Tasks submitted from other threads go to a shared deque.
+// Threads that wait for a TaskGroup run tasks meanwhile, so tasks may wait for
+// tasks of their own.
+class ThreadPool {
+public:
+  // tasks that are waited for together. A task that throws cancels the group,
+  // wait rethrows the first exception.
+  class TaskGroup {
+  public:
+    explicit TaskGroup(ThreadPool &pool) : pool{pool} {};
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    void run(std::function<void()> task);
+    // runs f(begin, end) on ranges of at most grain indices of [0, n). The
+    // range is halved on demand: the upper halves become tasks that idle
+    // workers steal, so uneven ranges still keep every worker busy. f must
+    // live until wait returns.
+    template <typename F> void forRange(size_t n, size_t grain, F const &f) {
+      split(0, n, std::max<size_t>(grain, 1), f);
+    }
+    void wait();
+
+    // cooperative: tasks of the group that have not started are skipped,
+    // running ones may poll cancelled() and return early
+    void cancel() { cancelled_ = true; };
+    bool cancelled() const { return cancelled_; };
+
+  private:
+    friend class ThreadPool;
+
+    template <typename F>
+    void split(size_t begin, size_t end, size_t grain, F const &f) {
+      while (end - begin > grain) {
+        size_t mid = begin + (end - begin) / 2;
+        run([this, mid, end, grain, &f]() { split(mid, end, grain, f); });
+        end = mid;
+      }
+      if (!cancelled()) {
+        f(begin, end);
+      }
+    }
+    void finish(std::exception_ptr error);
+
+    ThreadPool &pool;
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> cancelled_{false};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+  };
+
+  // nThreads 0 starts one worker per core
+  explicit ThreadPool(unsigned nThreads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // the pool of the process, started on first use
+  static ThreadPool &shared();
+
+  // TaskGroup::forRange on a group of its own, returns when all ranges are done
+  template <typename F> void parallelFor(size_t n, size_t grain, F const &f) {
+    TaskGroup group{*this};
+    group.forRange(n, grain, f);
+    group.wait();
+  }
+
+  unsigned threadCount() const {
+    return static_cast<unsigned>(workers.size());
+  };
+
+private:
+  struct Task {
+    std::function<void()> function;
+    TaskGroup *group;
+  };
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // the deque of the calling thread, the shared one for other threads
+  size_t ownQueue() const;
+  void push(Task task);
+  // runs one task, from deque self first. Returns false if there was none.
+  bool runOne(size_t self);
+  bool pop(size_t self, Task &task);
+  void work(size_t self);
+
+  std::vector<std::thread> workers;
+  // one per worker, the last one for submissions from other threads
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::atomic<size_t> nQueued{0};
+  std::atomic<bool> stopping{false};
+  std::mutex sleepMutex;
+  std::condition_variable wakeUp;
+};
+
+} // namespace oray
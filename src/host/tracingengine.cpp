@@ -0,0 +1,37 @@
+#include "tracingengine.hpp"
+#include "state.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace oray {
+
+TracingEngine::Sampling
+TracingEngine::Sampling::fromState(State const &state) {
+  Sampling sampling{};
+  sampling.nRays = static_cast<uint32_t>(std::max(state.nRays, 0));
+  sampling.samplingMode = static_cast<SamplingMode>(state.samplingMode);
+  sampling.sampler = static_cast<Sampler>(state.sampler);
+  sampling.traceMode = static_cast<TraceMode>(state.traceMode);
+  sampling.maxBounces = static_cast<uint32_t>(std::max(state.maxBounces, 1));
+  sampling.seed = static_cast<uint32_t>(state.seed);
+  return sampling;
+}
+
+void TracingEngine::checkTallySize(uint32_t nTriangles) {
+  if (nTriangles > MAX_TALLY_TRIANGLES) {
+    throw std::runtime_error(
+        "the scene has " + std::to_string(nTriangles) +
+        " triangles, the dense view factor tallies support at most " +
+        std::to_string(MAX_TALLY_TRIANGLES) + "!");
+  }
+}
+
+bool TracingEngine::Sampling::operator==(Sampling const &other) const {
+  return nRays == other.nRays && samplingMode == other.samplingMode &&
+         sampler == other.sampler && traceMode == other.traceMode &&
+         maxBounces == other.maxBounces && seed == other.seed;
+}
+
+} // namespace oray
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "commonStructs.h"
+#include "geometry.hpp"
+#include "orayobject.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace oray {
+
+struct State;
+
+// implementations of TracingEngine, the engine setting of the State
+enum EngineType : uint32_t { ENGINE_VULKAN = 0, ENGINE_CPU = 1 };
+
+// traces the rays of raygen.rgen from the triangles of a scene and tallies the
+// triangles they hit. The Raytracer does it on a ray tracing GPU, the
+// CpuTracer on the host. Both number the triangles over all objects in the
+// order of the object vector and produce the same rays for the same sampling,
+// so the GUI, the batch tools and the solvers can drive either of them.
+class TracingEngine {
+public:
+  // vertices and indices every Geometry of the scene was created from, the
+  // scene of engines that trace on the host
+  using GeometrySources = std::unordered_map<Geometry const *,
+                                             Geometry::Builder>;
+
+  // the rays of every launch, fixed between two resetTallies
+  struct Sampling {
+    // rays per source triangle and launch
+    uint32_t nRays = 0;
+    SamplingMode samplingMode = SAMPLING_COSINE;
+    Sampler sampler = SAMPLER_SOBOL;
+    TraceMode traceMode = TRACE_VIEW_FACTORS;
+    uint32_t maxBounces = 1;
+    // runs with the same seed draw the same rays, whatever the launches
+    uint32_t seed = 0;
+
+    // the sampling set in the GUI
+    static Sampling fromState(State const &state);
+    bool operator==(Sampling const &other) const;
+    bool operator!=(Sampling const &other) const { return !(*this == other); };
+  };
+
+  // the tallies are a dense n x n matrix, which the host holds several times
+  // over: as the 64 bit counts of the engine and of Tallies, 2 GiB each for
+  // 16384 triangles, and as the float view factors of the State. There is no
+  // sparse tally, the engines refuse scenes of more triangles instead of
+  // running out of memory.
+  static constexpr uint32_t MAX_TALLY_TRIANGLES = 16384;
+  // throws std::runtime_error for scenes above MAX_TALLY_TRIANGLES
+  static void checkTallySize(uint32_t nTriangles);
+
+  // hits of all launches since the last resetTallies
+  struct Tallies {
+    // counts[src * triangleCount() + target], 64 bits since progressive
+    // launches add up more hits than 32 bit counters hold
+    std::vector<uint64_t> counts;
+    // rays traced from every source triangle
+    std::vector<uint64_t> rowRays;
+  };
+
+  virtual ~TracingEngine() = default;
+
+  virtual char const *name() const = 0;
+  virtual uint32_t triangleCount() const = 0;
+  // milliseconds the last full build of the acceleration structures took
+  virtual float buildTime() const = 0;
+
+  // scene updates, the objects must be the ones the engine was created with.
+  // Both keep the sampling and restart the tallies.
+  //
+  // moves every object to its current transform
+  virtual void updateInstances(std::vector<OrayObject> const &orayObjects) = 0;
+  // rewrites the per triangle emissivities
+  virtual void updateMaterials(std::vector<OrayObject> const &orayObjects) = 0;
+
+  // drops the tallies, the following launches trace with sampling
+  virtual void resetTallies(Sampling const &sampling) = 0;
+  // traces sampling.nRays rays from each of the triangles and adds their hits
+  // to the tallies. Every triangle continues its own sample sequence, so
+  // launches refine the estimate of the earlier ones. Returns when the hits
+  // are tallied.
+  virtual void launch(std::vector<uint32_t> const &triangles) = 0;
+  virtual Tallies readTallies() = 0;
+
+  // a single launch from every triangle with the sampling of the state,
+  // stores the view factors and row errors in the state
+  virtual void traceModel() = 0;
+};
+
+} // namespace oray
@@ -0,0 +1,51 @@
+#include "viewfactors.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+namespace oray {
+
+namespace {
+// rows of one task, a row is one pass over nTriangles counts
+constexpr size_t ROWS_PER_TASK = 16;
+// 95% upper bound of a binomial fraction without hits is about 3 / n
+constexpr double RULE_OF_THREE = 3.;
+} // namespace
+
+void computeViewFactors(std::vector<uint64_t> const &counts,
+                        std::vector<uint64_t> const &rowRays,
+                        std::vector<float> &viewFactors,
+                        std::vector<float> &rowErrors) {
+  constexpr double z = 1.96;
+  size_t nTriangles = rowRays.size();
+  viewFactors.assign(counts.size(), 0.f);
+  rowErrors.assign(nTriangles, 0.f);
+  auto computeRows = [&](size_t begin, size_t end) {
+    for (size_t src = begin; src < end; ++src) {
+      if (rowRays[src] == 0) {
+        rowErrors[src] = std::numeric_limits<float>::infinity();
+        continue;
+      }
+      // every ray carries the same share of the emitted energy
+      double weight = 1. / static_cast<double>(rowRays[src]);
+      double variance = 0.;
+      for (size_t target = 0; target < nTriangles; ++target) {
+        size_t idx = src * nTriangles + target;
+        double viewFactor = counts[idx] * weight;
+        viewFactors[idx] = static_cast<float>(viewFactor);
+        variance += viewFactor * (1. - viewFactor) * weight;
+      }
+      // the variance is 0 if every count is 0 or rowRays, e.g. for a row that
+      // has not hit anything yet, the error never drops below the bound of
+      // the fractions the rays have not seen
+      rowErrors[src] = static_cast<float>(
+          std::max(z * std::sqrt(variance), RULE_OF_THREE * weight));
+    }
+  };
+  ThreadPool::shared().parallelFor(nTriangles, ROWS_PER_TASK, computeRows);
+}
+
+} // namespace oray
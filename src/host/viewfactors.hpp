@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace oray {
+// view factors F_ij = counts[i * n + j] / rowRays[i] of n triangles, and the
+// 95% confidence half width of every row. Each F_ij is a binomial fraction of
+// the rays of row i, the row error combines their variances
+// F_ij (1 - F_ij) / n_i. The error is at least 3 / n_i, the 95% bound of a
+// view factor no ray of the row hit, so rows whose counts are all 0 or n_i
+// are not taken for exact. Rows without rays get an infinite error.
+void computeViewFactors(std::vector<uint64_t> const &counts,
+                        std::vector<uint64_t> const &rowRays,
+                        std::vector<float> &viewFactors,
+                        std::vector<float> &rowErrors);
+} // namespace oray
@@ -0,0 +1,260 @@
+#include "widebvh.hpp"
+#include "bvhkernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace oray {
+
+using kernels::intersectBlock;
+
+static_assert(sizeof(WideBvh::Node) == 64, "a node must fill a cache line");
+
+namespace {
+constexpr uint32_t STACK_SIZE = 256;
+constexpr int MIN_EXPONENT = -126;
+
+float halfArea(Bvh::Node const &node) {
+  glm::vec3 d = node.max - node.min;
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// 2^exponent, exact for normal floats
+float exp2i(int exponent) {
+  uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// decoding in the slab test uses the same expression, so the decoded boxes
+// contain the original ones despite rounding
+float decode(float origin, uint8_t q, float scale) {
+  return origin + static_cast<float>(q) * scale;
+}
+
+// entry distances of the ray into the children of the node, returns the
+// children it enters within [tMin, tMax]
+uint32_t childEntries(WideBvh::Node const &node, glm::vec3 ori,
+                      glm::vec3 invDir, float tMin, float tMax,
+                      float *entries) {
+#if defined(ORAY_SSE)
+  static_assert(WideBvh::WIDTH == 4, "the slab test is 4 wide");
+  __m128 tNear = _mm_set1_ps(tMin);
+  __m128 tFar = _mm_set1_ps(tMax);
+  __m128i zero = _mm_setzero_si128();
+  for (int k = 0; k < 3; ++k) {
+    __m128 origin = _mm_set1_ps(node.origin[k]);
+    __m128 scale = _mm_set1_ps(exp2i(node.exponent[k]));
+    int32_t packedMin, packedMax;
+    std::memcpy(&packedMin, node.qMin[k], sizeof(packedMin));
+    std::memcpy(&packedMax, node.qMax[k], sizeof(packedMax));
+    __m128 qMin = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(packedMin), zero), zero));
+    __m128 qMax = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(packedMax), zero), zero));
+    __m128 rayOri = _mm_set1_ps(ori[k]);
+    __m128 rayInvDir = _mm_set1_ps(invDir[k]);
+    __m128 t0 = _mm_mul_ps(
+        _mm_sub_ps(_mm_add_ps(origin, _mm_mul_ps(qMin, scale)), rayOri),
+        rayInvDir);
+    __m128 t1 = _mm_mul_ps(
+        _mm_sub_ps(_mm_add_ps(origin, _mm_mul_ps(qMax, scale)), rayOri),
+        rayInvDir);
+    tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+    tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+  }
+  _mm_storeu_ps(entries, tNear);
+  return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) &
+         node.validMask;
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < WideBvh::WIDTH; ++i) {
+    float tNear = tMin;
+    float tFar = tMax;
+    for (int k = 0; k < 3; ++k) {
+      float scale = exp2i(node.exponent[k]);
+      float t0 = (decode(node.origin[k], node.qMin[k][i], scale) - ori[k]) *
+                 invDir[k];
+      float t1 = (decode(node.origin[k], node.qMax[k][i], scale) - ori[k]) *
+                 invDir[k];
+      tNear = std::max(tNear, std::min(t0, t1));
+      tFar = std::min(tFar, std::max(t0, t1));
+    }
+    entries[i] = tNear;
+    if (tNear <= tFar) {
+      mask |= 1u << i;
+    }
+  }
+  return mask & node.validMask;
+#endif
+}
+
+// quantizes the child boxes on axis k with steps of 2^exponent, fails if a
+// box does not fit into 255 steps
+bool encodeAxis(WideBvh::Node &node, int k, int exponent,
+                std::vector<Bvh::Node const *> const &children) {
+  float scale = exp2i(exponent);
+  float origin = node.origin[k];
+  for (size_t i = 0; i < children.size(); ++i) {
+    float min = children[i]->min[k];
+    float max = children[i]->max[k];
+    int qMin = static_cast<int>(
+        std::clamp(std::floor((min - origin) / scale), 0.f, 255.f));
+    int qMax = static_cast<int>(
+        std::clamp(std::ceil((max - origin) / scale), 0.f, 255.f));
+    while (qMin > 0 && decode(origin, qMin, scale) > min) {
+      --qMin;
+    }
+    while (qMax < 255 && decode(origin, qMax, scale) < max) {
+      ++qMax;
+    }
+    if (decode(origin, qMin, scale) > min ||
+        decode(origin, qMax, scale) < max) {
+      return false;
+    }
+    node.qMin[k][i] = static_cast<uint8_t>(qMin);
+    node.qMax[k][i] = static_cast<uint8_t>(qMax);
+  }
+  return true;
+}
+} // namespace
+
+WideBvh::WideBvh(Bvh const &bvh) : bvh{bvh} {
+  nodes.reserve(bvh.nodeCount() / 2 + 1);
+  collapse(0);
+}
+
+// turns the binary node into a wide node whose children are the nodes up to
+// two levels further down, expanding the largest inner children first
+uint32_t WideBvh::collapse(uint32_t binaryNode) {
+  auto const &binary = bvh.getNodes();
+  uint32_t nodeIdx = static_cast<uint32_t>(nodes.size());
+  nodes.emplace_back();
+
+  std::vector<uint32_t> children;
+  if (binary[binaryNode].count > 0) {
+    children.push_back(binaryNode);
+  } else {
+    children = {binaryNode + 1, binary[binaryNode].first};
+  }
+  while (children.size() < WIDTH) {
+    int largest = -1;
+    for (size_t i = 0; i < children.size(); ++i) {
+      if (binary[children[i]].count == 0 &&
+          (largest < 0 || halfArea(binary[children[i]]) >
+                              halfArea(binary[children[largest]]))) {
+        largest = static_cast<int>(i);
+      }
+    }
+    if (largest < 0) {
+      break;
+    }
+    uint32_t inner = children[largest];
+    children[largest] = inner + 1;
+    children.push_back(binary[inner].first);
+  }
+
+  std::vector<Bvh::Node const *> childNodes;
+  glm::vec3 min{std::numeric_limits<float>::max()};
+  glm::vec3 max{std::numeric_limits<float>::lowest()};
+  for (uint32_t c : children) {
+    childNodes.push_back(&binary[c]);
+    min = glm::min(min, binary[c].min);
+    max = glm::max(max, binary[c].max);
+  }
+  Node node{};
+  node.origin = min;
+  for (int k = 0; k < 3; ++k) {
+    // smallest power of two step that spans the node in 255 steps. If
+    // rounding in decode pushes a bound over the last step, the step doubles.
+    float extent = max[k] - min[k];
+    int exponent = MIN_EXPONENT;
+    if (extent > 0.f) {
+      exponent = std::max(MIN_EXPONENT, static_cast<int>(std::ceil(
+                                            std::log2(extent / 255.f))));
+    }
+    while (!encodeAxis(node, k, exponent, childNodes)) {
+      ++exponent;
+    }
+    node.exponent[k] = static_cast<int8_t>(exponent);
+  }
+
+  for (size_t i = 0; i < children.size(); ++i) {
+    node.validMask |= static_cast<uint8_t>(1u << i);
+  }
+  nodes[nodeIdx] = node;
+  // children are collapsed after the node, the vector may grow meanwhile
+  for (size_t i = 0; i < children.size(); ++i) {
+    Bvh::Node const &child = binary[children[i]];
+    uint32_t index =
+        child.count > 0 ? LEAF_BIT | child.first : collapse(children[i]);
+    nodes[nodeIdx].child[i] = index;
+  }
+  return nodeIdx;
+}
+
+Bvh::Hit WideBvh::intersect(Bvh::Ray const &ray) const {
+  Bvh::Hit hit;
+  float tMax = ray.tMax;
+  glm::vec3 invDir = 1.f / ray.dir;
+  auto const &blocks = bvh.getBlocks();
+
+  struct Entry {
+    uint32_t child;
+    float entry;
+  };
+  Entry stack[STACK_SIZE];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = {0, ray.tMin};
+  while (stackSize > 0) {
+    Entry top = stack[--stackSize];
+    // a closer hit was found after the child was pushed
+    if (top.entry > tMax) {
+      continue;
+    }
+    if ((top.child & LEAF_BIT) != 0) {
+      intersectBlock(blocks[top.child & ~LEAF_BIT], ray, tMax, hit.triangle);
+      continue;
+    }
+
+    Node const &node = nodes[top.child];
+    float entries[WIDTH];
+    uint32_t mask =
+        childEntries(node, ray.ori, invDir, ray.tMin, tMax, entries);
+    // push far to near, so the nearest child is visited next
+    uint32_t order[WIDTH];
+    uint32_t nHits = 0;
+    for (uint32_t i = 0; i < WIDTH; ++i) {
+      if ((mask & (1u << i)) == 0) {
+        continue;
+      }
+      uint32_t pos = nHits++;
+      while (pos > 0 && entries[order[pos - 1]] < entries[i]) {
+        order[pos] = order[pos - 1];
+        --pos;
+      }
+      order[pos] = i;
+    }
+    for (uint32_t k = 0; k < nHits; ++k) {
+      stack[stackSize++] = {node.child[order[k]], entries[order[k]]};
+    }
+  }
+
+  if (hit.triangle != NO_HIT) {
+    hit.t = tMax;
+  }
+  return hit;
+}
+
+void WideBvh::intersect(std::vector<Bvh::Ray> const &rays,
+                        std::vector<Bvh::Hit> &hits) const {
+  hits.resize(rays.size());
+  for (size_t i = 0; i < rays.size(); ++i) {
+    hits[i] = intersect(rays[i]);
+  }
+}
+
+} // namespace oray
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "bvh.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace oray {
+
+// a Bvh collapsed to WIDTH children per node. The child boxes are stored
+// with 8 bit coordinates relative to the node, so a node fills exactly one
+// cache line and one fetch tests all children with one SIMD slab test. The
+// quantized boxes are rounded outwards, they never lose a hit. Shares the
+// triangle blocks of the binary Bvh, which must outlive it.
+class WideBvh {
+public:
+  static constexpr uint32_t WIDTH = 4;
+  // marks a child that is a leaf, the other bits index the triangle block
+  static constexpr uint32_t LEAF_BIT = 0x80000000;
+
+  struct alignas(64) Node {
+    // child box k on axis a: origin[a] + q[a][k] * 2^exponent[a]
+    glm::vec3 origin;
+    int8_t exponent[3];
+    // bit k is set if child k exists
+    uint8_t validMask;
+    uint32_t child[WIDTH];
+    uint8_t qMin[3][WIDTH];
+    uint8_t qMax[3][WIDTH];
+  };
+
+  explicit WideBvh(Bvh const &bvh);
+
+  WideBvh(const WideBvh &) = delete;
+  WideBvh &operator=(const WideBvh &) = delete;
+
+  // same results as Bvh::intersect
+  Bvh::Hit intersect(Bvh::Ray const &ray) const;
+  void intersect(std::vector<Bvh::Ray> const &rays,
+                 std::vector<Bvh::Hit> &hits) const;
+
+  size_t nodeCount() const { return nodes.size(); };
+  size_t nodeMemorySize() const { return nodes.size() * sizeof(Node); };
+
+private:
+  uint32_t collapse(uint32_t binaryNode);
+
+  Bvh const &bvh;
+  std::vector<Node> nodes;
+};
+
+} // namespace oray
@@ -4,18 +4,7 @@
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 #extension GL_EXT_buffer_reference2 : require
 
-struct Constants {
-  uint64_t indexBufferAddress;
-  uint64_t vertexBufferAddress;
-  uint64_t oriBufferAddress;
-  uint64_t dirBufferAddress;
-//  uint64_t hitBuffer;
-  uint64_t triangleIndex;
-//  uint64_t nRays;
-//  bool recordOri;
-//  bool recordDir;
-//  bool recordHit;sa
-};
+#include "structs.h"
 
 layout(buffer_reference, scalar) buffer VertPos{ vec4 v[];};
 layout(buffer_reference, scalar) buffer Dirbuf{ vec4 d[];};
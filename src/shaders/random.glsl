@@ -1,4 +1,7 @@
-// function for the seed
+// random numbers of raygen.rgen, ported to the host in src/host/sampling.hpp,
+// keep in sync
+
+// hash of two values, seeds the Sobol scrambling of a triangle
 uint tea(uint val0, uint val1) {
     uint v0 = val0;
     uint v1 = val1;
@@ -15,14 +18,33 @@ uint tea(uint val0, uint val1) {
     return v0;
 }
 
-uint lcg(inout uint prev) {
-    uint LCG_A = 1664525u;
-    uint LCG_C = 1013904223u;
-    prev = (LCG_A * prev + LCG_C);
+// Philox4x32-10 of Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+// 3", SC 2011. A counter based generator: the output is a bijection of the
+// counter under the key, so every block of numbers can be computed on its
+// own, in any order and on any device.
+const uint PHILOX_M0 = 0xD2511F53u;
+const uint PHILOX_M1 = 0xCD9E8D57u;
+const uint PHILOX_W0 = 0x9E3779B9u;
+const uint PHILOX_W1 = 0xBB67AE85u;
 
-    return prev & 0x00FFFFFF;
+uvec4 philox(uvec4 counter, uvec2 key) {
+    for (int i = 0; i < 10; i++) {
+        uint hi0, lo0, hi1, lo1;
+        umulExtended(PHILOX_M0, counter.x, hi0, lo0);
+        umulExtended(PHILOX_M1, counter.z, hi1, lo1);
+        counter = uvec4(hi1 ^ counter.y ^ key.x, lo1,
+                        hi0 ^ counter.w ^ key.y, lo0);
+        key += uvec2(PHILOX_W0, PHILOX_W1);
+    }
+    return counter;
 }
 
-float rnd(inout uint prev) {
-    return (float(lcg(prev)) / float(0x01000000));
-}
\ No newline at end of file
+// four numbers in [0, 1) for sample sampleIdx of triangle tri in the run with
+// the given seed. Block 0 places the ray, block 1 + k decides its bounce k.
+// The numbers depend on nothing else, not on the launch a sample is traced in
+// nor on the other samples.
+vec4 rayRandom(uint seed, uint tri, uint64_t sampleIdx, uint block) {
+    uvec4 counter = uvec4(uint(sampleIdx), uint(sampleIdx >> 32), block, 0u);
+    uvec4 bits = philox(counter, uvec2(seed, tri));
+    return vec4(bits >> 8u) / float(0x01000000);
+}
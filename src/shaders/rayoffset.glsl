@@ -0,0 +1,27 @@
+// ray origins off the surface they start on, ported to the host in
+// src/host/rayoffset.hpp, keep in sync
+
+// constants of Wächter and Binder for scenes of unit scale, the first two are
+// multiplied by the scene scale
+const float OFFSET_ORIGIN = 1.0 / 32.0;
+const float OFFSET_FLOAT_SCALE = 1.0 / 65536.0;
+const float OFFSET_INT_SCALE = 256.0;
+
+// moves p along the normal n of its surface by a fixed number of float steps,
+// which grow with the magnitude of p like the rounding errors of p do. Close
+// to the origin, where the steps get tiny, by a fixed fraction of the scene
+// scale instead. Rays from the result with tMin 0 cannot hit the surface
+// again. Wächter and Binder, "A Fast and Robust Method for Avoiding
+// Self-Intersection", Ray Tracing Gems, 2019.
+vec3 offsetRay(vec3 p, vec3 n, float sceneScale) {
+    ivec3 ofI = ivec3(OFFSET_INT_SCALE * n);
+    vec3 pI = vec3(
+        intBitsToFloat(floatBitsToInt(p.x) + (p.x < 0 ? -ofI.x : ofI.x)),
+        intBitsToFloat(floatBitsToInt(p.y) + (p.y < 0 ? -ofI.y : ofI.y)),
+        intBitsToFloat(floatBitsToInt(p.z) + (p.z < 0 ? -ofI.z : ofI.z)));
+    float origin = OFFSET_ORIGIN * sceneScale;
+    float floatScale = OFFSET_FLOAT_SCALE * sceneScale;
+    return vec3(abs(p.x) < origin ? p.x + floatScale * n.x : pI.x,
+                abs(p.y) < origin ? p.y + floatScale * n.y : pI.y,
+                abs(p.z) < origin ? p.z + floatScale * n.z : pI.z);
+}
@@ -0,0 +1,82 @@
+// shared between the raytracing shaders and the line shader, keep in sync
+// with RtPushConstants in src/host/commonStructs.h
+struct Constants {
+  // MeshInfo per object and the object index of every triangle
+  uint64_t meshBufferAddress;
+  uint64_t tri2MeshBufferAddress;
+  uint64_t oriBufferAddress;
+  uint64_t dirBufferAddress;
+  uint64_t hitBufferAddress;
+  // nTriangles x nTriangles hit counters, [source * nTriangles + target]
+  uint64_t countBufferAddress;
+  // optional list of RowEntry, one per launch row. Without it the rows are
+  // consecutive source triangles and share launchIndex.
+  uint64_t rowBufferAddress;
+  // one float emissivity per triangle, read by TRACE_GEBHART
+  uint64_t materialBufferAddress;
+  // first row of the launch, gl_LaunchIDEXT.y is added on top. Without a row
+  // buffer the row is the source triangle.
+  uint64_t triangleIndex;
+  uint64_t nTriangles;
+  uint samplingMode;
+  uint sampler;
+  // number of previous launches accumulated into the same counters
+  uint launchIndex;
+  uint traceMode;
+  // TRACE_GEBHART drops rays that are still reflected after this many hits
+  uint maxBounces;
+  // largest coordinate magnitude of the scene, scales the ray origin offsets
+  float sceneScale;
+  // longer than the diagonal of the scene bounds
+  float tMax;
+  // run seed of the random numbers, the same seed draws the same rays
+  uint seed;
+};
+
+// triangles are numbered over all objects of the scene, an object's
+// triangles start at triangleOffset. The TLAS instance of the object uses the
+// same offset as custom index.
+struct MeshInfo {
+  uint64_t indexBufferAddress;
+  uint64_t vertexBufferAddress;
+  // object to world
+  mat4 transform;
+  uint triangleOffset;
+  uint padding;
+};
+
+// source triangle of a launch row and the number of launches its counters
+// already hold
+struct RowEntry {
+  uint triangle;
+  uint launchIndex;
+};
+
+struct RayPayload {
+    bool hit;
+    float energy;
+    // distance along the ray to the hit
+    float hitT;
+    // of corners 1 and 2 of the hit triangle, corner 0 has the rest
+    vec2 barycentrics;
+    uint primitiveId;
+    // custom index of the hit instance, the index of its first triangle
+    uint instanceId;
+};
+
+// written to the hit buffer for rays that left the scene
+const uint NO_HIT = 0xFFFFFFFF;
+
+// direction sampling strategies
+const uint SAMPLING_LEGACY = 0;
+const uint SAMPLING_COSINE = 1;
+
+// sources of the four random numbers per ray
+const uint SAMPLER_RANDOM = 0;
+const uint SAMPLER_SOBOL = 1;
+
+// TRACE_VIEW_FACTORS counts the first hit of every ray. TRACE_GEBHART follows
+// diffuse reflections until the ray is absorbed and counts the absorbing
+// triangle, which yields Gebhart's absorption factors.
+const uint TRACE_VIEW_FACTORS = 0;
+const uint TRACE_GEBHART = 1;
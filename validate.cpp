@@ -0,0 +1,187 @@
+#include "analytic.hpp"
+#include "commonStructs.h"
+#include "cputracer.hpp"
+#include "geometry.hpp"
+#include "state.hpp"
+#include "tracingengine.hpp"
+#include "viewfactors.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// checks the CPU tracer against the closed form view factor of two parallel
+// plates, run from bin/ like the app. Fails if an estimate with cosine
+// sampling is off by more than MAX_SIGMAS standard errors, or if adaptive
+// tracing would retire a row after one launch without hits. Reports the rays
+// every sampling needs for the same error.
+// usage: oray-validate
+
+namespace {
+constexpr char const *MODEL = "models/two_plates.obj";
+// rays per triangle of the checked estimates
+constexpr uint32_t CHECK_RAYS = 1 << 16;
+// a correct tracer exceeds this with a chance of about 1 in 16000 per seed
+constexpr double MAX_SIGMAS = 4.;
+constexpr uint32_t N_SEEDS = 8;
+// rms error over the seeds the ray counts are reported for
+constexpr double TARGET_ERROR = 2e-3;
+// the ray counts grow by launches of this many rays per triangle
+constexpr uint32_t LAUNCH_RAYS = 64;
+
+// triangles 2 and 3 form the 1 x 1 plate at y = 0, which faces the 1.6 x 1.6
+// plate of triangles 0 and 1 at a distance of 0.8. Both triangles of a plate
+// have the same area, so the plate view factor is the fraction of the rays of
+// 2 and 3 that hit 0 or 1.
+std::vector<uint32_t> const SOURCES{2, 3};
+
+double exactViewFactor() {
+  return oray::analytic::parallelRectangles({-.5f, -.5f}, {.5f, .5f},
+                                            {-.8f, -.8f}, {.8f, .8f}, .8f);
+}
+
+double plateViewFactor(oray::TracingEngine::Tallies const &tallies) {
+  uint64_t hits = 0;
+  uint64_t rays = 0;
+  for (uint32_t src : SOURCES) {
+    hits += tallies.counts[src * 4 + 0] + tallies.counts[src * 4 + 1];
+    rays += tallies.rowRays[src];
+  }
+  return static_cast<double>(hits) / static_cast<double>(rays);
+}
+
+oray::TracingEngine::Sampling sampling(oray::SamplingMode mode,
+                                       oray::Sampler sampler, uint32_t nRays,
+                                       uint32_t seed) {
+  oray::TracingEngine::Sampling result{};
+  result.nRays = nRays;
+  result.samplingMode = mode;
+  result.sampler = sampler;
+  result.traceMode = oray::TRACE_VIEW_FACTORS;
+  result.maxBounces = 1;
+  result.seed = seed;
+  return result;
+}
+
+char const *name(oray::SamplingMode mode, oray::Sampler sampler) {
+  char const *names[2][2] = {{"legacy random", "legacy sobol"},
+                             {"cosine random", "cosine sobol"}};
+  return names[mode == oray::SAMPLING_COSINE][sampler == oray::SAMPLER_SOBOL];
+}
+
+// CHECK_RAYS rays per triangle for every seed. Fails if one estimate is off by
+// more than MAX_SIGMAS binomial standard errors, which also bound the smaller
+// errors of the Sobol sampler.
+bool check(oray::TracingEngine &engine, oray::Sampler sampler, double exact) {
+  double sigma = std::sqrt(exact * (1. - exact) /
+                           (static_cast<double>(CHECK_RAYS) * SOURCES.size()));
+  double maxError = 0.;
+  for (uint32_t seed = 0; seed < N_SEEDS; ++seed) {
+    engine.resetTallies(
+        sampling(oray::SAMPLING_COSINE, sampler, CHECK_RAYS, seed));
+    engine.launch(SOURCES);
+    maxError = std::max(
+        maxError, std::abs(plateViewFactor(engine.readTallies()) - exact));
+  }
+  bool passed = maxError <= MAX_SIGMAS * sigma;
+  std::cout << name(oray::SAMPLING_COSINE, sampler) << ", " << CHECK_RAYS
+            << " rays: largest error " << maxError << ", allowed "
+            << MAX_SIGMAS * sigma << (passed ? " ok" : " FAILED") << std::endl;
+  return passed;
+}
+
+// rows whose counts are all 0 or all rays have a binomial variance of 0, they
+// must stay above the default tolerance after a launch of the default rays
+bool checkRowErrors() {
+  oray::State defaults{};
+  uint64_t nRays = static_cast<uint64_t>(defaults.nRays);
+  // row 0 hit nothing, every ray of row 1 hit triangle 0
+  std::vector<uint64_t> counts{0, 0, nRays, 0};
+  std::vector<uint64_t> rowRays{nRays, nRays};
+  std::vector<float> viewFactors;
+  std::vector<float> rowErrors;
+  oray::computeViewFactors(counts, rowRays, viewFactors, rowErrors);
+  bool passed = rowErrors[0] > defaults.tolerance &&
+                rowErrors[1] > defaults.tolerance;
+  std::cout << "row errors without variance, " << nRays
+            << " rays: no hits " << rowErrors[0] << ", one target "
+            << rowErrors[1] << ", tolerance " << defaults.tolerance
+            << (passed ? " ok" : " FAILED") << std::endl;
+  return passed;
+}
+
+// rays per triangle until the rms error over the seeds drops to TARGET_ERROR,
+// 0 if it does not within CHECK_RAYS. The launches continue the sample
+// sequences, so after k launches the tallies are those of a single trace of
+// k * LAUNCH_RAYS rays. rmsError is the one of the returned ray count, or of
+// CHECK_RAYS.
+uint32_t raysForError(oray::TracingEngine &engine, oray::SamplingMode mode,
+                      oray::Sampler sampler, double exact, double &rmsError) {
+  // squared errors summed over the seeds, after 1, 2, 4, ... launches
+  std::vector<double> squaredErrors;
+  for (uint32_t seed = 0; seed < N_SEEDS; ++seed) {
+    engine.resetTallies(sampling(mode, sampler, LAUNCH_RAYS, seed));
+    size_t checkpoint = 0;
+    for (uint32_t launches = 1; launches * LAUNCH_RAYS <= CHECK_RAYS;
+         ++launches) {
+      engine.launch(SOURCES);
+      if ((launches & (launches - 1)) != 0) {
+        continue;
+      }
+      double error = plateViewFactor(engine.readTallies()) - exact;
+      squaredErrors.resize(std::max(squaredErrors.size(), checkpoint + 1));
+      squaredErrors[checkpoint++] += error * error;
+    }
+  }
+  for (size_t i = 0; i < squaredErrors.size(); ++i) {
+    rmsError = std::sqrt(squaredErrors[i] / N_SEEDS);
+    if (rmsError <= TARGET_ERROR) {
+      return LAUNCH_RAYS << i;
+    }
+  }
+  return 0;
+}
+} // namespace
+
+int main() {
+  try {
+    oray::Geometry::Builder builder{};
+    builder.loadModel(MODEL);
+    auto state = std::make_shared<oray::State>();
+    oray::CpuTracer tracer({{&builder}}, state);
+    if (tracer.triangleCount() != 4) {
+      throw std::runtime_error("the two plates must be four triangles!");
+    }
+    double exact = exactViewFactor();
+    std::cout << "plate view factor: analytic " << exact << std::endl;
+
+    bool passed = check(tracer, oray::SAMPLER_RANDOM, exact);
+    passed = check(tracer, oray::SAMPLER_SOBOL, exact) && passed;
+    passed = checkRowErrors() && passed;
+
+    std::cout << "rays per triangle for an rms error of " << TARGET_ERROR
+              << " over " << N_SEEDS << " seeds:" << std::endl;
+    for (auto mode : {oray::SAMPLING_LEGACY, oray::SAMPLING_COSINE}) {
+      for (auto sampler : {oray::SAMPLER_RANDOM, oray::SAMPLER_SOBOL}) {
+        double rmsError = 0.;
+        uint32_t nRays = raysForError(tracer, mode, sampler, exact, rmsError);
+        std::cout << "  " << name(mode, sampler) << ": ";
+        if (nRays > 0) {
+          std::cout << nRays << std::endl;
+        } else {
+          std::cout << "more than " << CHECK_RAYS << ", rms error "
+                    << rmsError << std::endl;
+        }
+      }
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}